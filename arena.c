@@ -0,0 +1,144 @@
+/*
+ * arena.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Bump allocator for the strings and buffers of a traversal. Each thread has
+ * an arena of its own, memory is taken from the current chunk and released
+ * in bulk by going back to a mark taken earlier, when a file or a directory
+ * is done. Marks are released in the reverse order they are taken.
+ */
+
+#include <ptrash.h>
+
+#define ACHUNK          (256 * 1024)    /* size of a chunk */
+#define AALIGN(n)       (((n) + 15) & ~(size_t) 15)
+
+struct achunk
+{
+    struct achunk *prev;    /* chunk in use before this one */
+    size_t size;            /* bytes in buf */
+    size_t used;
+    char buf[];
+};
+
+static __thread struct achunk *cur = NULL;
+static __thread struct achunk *spare = NULL;  /* kept for the next chunk */
+
+
+/*
+ * arena_alloc: returns @n bytes from the arena of the calling thread. It
+ * exits on error, like the callers of malloc(3) do.
+ */
+void *
+arena_alloc (size_t n)
+{
+    void *p = NULL;
+    struct achunk *c = NULL;
+
+    n = AALIGN (n);
+    if (cur == NULL || cur->size - cur->used < n)
+    {
+        if (spare != NULL && spare->size >= n)
+        {
+            c = spare;
+            spare = NULL;
+        }
+        else if ((c = malloc (sizeof (struct achunk)
+                              + (n > ACHUNK ? n : ACHUNK))) == NULL)
+            err (-1, "could not allocate memory");
+        else
+            c->size = n > ACHUNK ? n : ACHUNK;
+        c->used = 0;
+        c->prev = cur;
+        cur = c;
+    }
+    p = cur->buf + cur->used;
+    cur->used += n;
+
+    return p;
+}
+
+
+/*
+ * arena_strdup: returns a copy of @s in the arena of the calling thread.
+ */
+char *
+arena_strdup (const char *s)
+{
+    size_t l = strlen (s) + 1;
+
+    return memcpy (arena_alloc (l), s, l);
+}
+
+
+/*
+ * arena_path: returns the path @file under @dir, built in the arena of the
+ * calling thread.
+ */
+char *
+arena_path (const char *dir, const char *file)
+{
+    size_t dl = strlen (dir), fl = strlen (file);
+    char *p = arena_alloc (dl + fl + 2);
+
+    memcpy (p, dir, dl);
+    if (dl && dir[dl - 1] != '/')
+        p[dl++] = '/';
+    memcpy (p + dl, file, fl + 1);
+
+    return p;
+}
+
+
+/*
+ * arena_mark: returns the current position of the arena of the calling
+ * thread, for arena_release.
+ */
+amark
+arena_mark (void)
+{
+    amark m = { cur, cur != NULL ? cur->used : 0 };
+
+    return m;
+}
+
+
+/*
+ * arena_release: release all that was allocated after the mark @m was
+ * taken. One emptied chunk is kept, so that a loop taking and releasing a
+ * mark at a chunk boundary does not call malloc(3) each time.
+ */
+void
+arena_release (amark m)
+{
+    struct achunk *c = NULL;
+
+    while (cur != m.chunk)
+    {
+        c = cur;
+        cur = c->prev;
+        if (spare == NULL && c->size == ACHUNK)
+            spare = c;
+        else
+            free (c);
+    }
+    if (cur != NULL)
+        cur->used = m.used;
+}
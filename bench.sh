@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# bench.sh -- move unwanted files to trash; This file is part of the program
+# 'ptrash'.
+# Copyright (C) 2026 Prasad J Pandit
+#
+# 'ptrash' is a free software; you can redistribute it and/or modify it under
+# the terms of GNU General Public Licence as published by Free Software
+# Foundation; either version 2 of the licence, or (at your option) any later
+# version.
+#
+# Time ptrash on trees made by gentree, as run by `make bench':
+#
+#   sh bench.sh PTRASH GENTREE
+#
+# Each workload is made afresh, moved to trash, listed, restored, moved
+# again and deleted from trash. One line of CSV per operation goes to the
+# standard output: the commit, workload, operation, options, files and
+# bytes of the tree, wall time in seconds, and from --stats=json the time
+# ptrash measured, renames, copies, bytes copied and system calls.
+#
+# BENCH_DIR    where the trees are made, a new directory in $TMPDIR by default
+# BENCH_TRASH  XDG_DATA_HOME of the runs, $BENCH_DIR/data by default; give
+#              one on another file system to time copies rather than renames.
+#              The moves then take --home-trash, else a mount that can hold
+#              a trash of its own would get one and keep them renames
+# BENCH_SCALE  divide the number of files of each workload by it, default 1
+# BENCH_ARGS   more options for the moves, as in "-j 4" or "--async"
+# BENCH_SEED   seed of gentree, default 1
+#
+
+PTRASH=${1:-./ptrash}
+GENTREE=${2:-./gentree}
+SCALE=${BENCH_SCALE:-1}
+SEED=${BENCH_SEED:-1}
+ARGS=$BENCH_ARGS
+[ -n "$BENCH_TRASH" ] && ARGS="--home-trash${ARGS:+ $ARGS}"
+
+case $PTRASH in /*) ;; *) PTRASH=$PWD/$PTRASH ;; esac
+case $GENTREE in /*) ;; *) GENTREE=$PWD/$GENTREE ;; esac
+
+if [ -n "$BENCH_DIR" ]; then
+    D=$BENCH_DIR
+    mkdir -p "$D" || exit 1
+else
+    D=$(mktemp -d "${TMPDIR:-/tmp}/ptrash-bench.XXXXXX") || exit 1
+    trap 'rm -rf "$D"' EXIT
+    trap 'exit 1' HUP INT TERM
+fi
+export XDG_DATA_HOME=${BENCH_TRASH:-$D/data}
+export XDG_RUNTIME_DIR=$D/run       # no ptrashd serves the runs
+mkdir -p "$XDG_DATA_HOME" "$XDG_RUNTIME_DIR"
+
+COMMIT=$(cd "$(dirname "$0")" && git describe --always --dirty 2>/dev/null)
+COMMIT=${COMMIT:-$("$PTRASH" -V 2>/dev/null | sed -n '1s/.* //p')}
+
+# workload, arguments of gentree
+WORKLOADS="tiny $((1000000 / SCALE))
+deep 256
+huge 3 $((1073741824 / SCALE))
+sparse 4 $((4294967296 / SCALE))
+fifo $((10000 / SCALE))"
+
+now ()
+{
+    date +%s%N
+}
+
+# field NAME: the first value of the JSON field NAME in $D/stats
+field ()
+{
+    sed -n "s/.*\"$1\":\([0-9]*\).*/\1/p" "$D/stats" | head -1
+}
+
+# run OP ARGS...: time ptrash ARGS and print a line of CSV
+run ()
+{
+    op=$1
+    shift
+    sync
+    : > "$D/stats"
+    t0=$(now)
+    "$PTRASH" "$@" 2>"$D/stats" >/dev/null || echo "bench: $op $w failed" >&2
+    t1=$(now)
+    sys=$(grep -o '"syscalls":[0-9]*' "$D/stats" | \
+          awk -F: '{ n += $2 } END { print n + 0 }')
+    if ! grep -q '"elapsed_ns"' "$D/stats"; then
+        sys=
+    fi
+    wall=$(awk "BEGIN { printf \"%.3f\", ($t1 - $t0) / 1e9 }")
+    st="$(field elapsed_ns),$(field renames),$(field copies)"
+    echo "$COMMIT,$w,$op,$ARGS,$files,$bytes,$wall,$st,$(field bytes_copied),$sys"
+}
+
+echo "commit,workload,op,args,files,bytes,wall_s,elapsed_ns,renames,copies,bytes_copied,syscalls"
+echo "$WORKLOADS" | while read w n size; do
+    [ "$n" -gt 0 ] || continue
+    rm -rf "$D/src"
+    mkdir -p "$D/src"
+    out=$("$GENTREE" -s "$SEED" $w "$D/src/$w" $n $size) || exit 1
+    set -- $out
+    files=$1
+    bytes=$2
+    run move --stats=json $ARGS "$D/src/$w"
+    while "$PTRASH" --status 2>/dev/null | grep -q .; do
+        sleep 0.1           # --async copies are done in the background
+    done
+    run list --list
+    run restore --stats=json -r $w
+    "$PTRASH" $ARGS "$D/src/$w" && \
+        while "$PTRASH" --status 2>/dev/null | grep -q .; do sleep 0.1; done
+    run delete --stats=json -d $w
+done
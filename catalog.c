@@ -0,0 +1,1196 @@
+/*
+ * catalog.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The catalog is an index of Trash/info kept in Trash/ptrash.catalog, so
+ * that lookups and listings need not open one .trashinfo file per entry.
+ * The file is memory mapped and laid out as
+ *
+ *   header | name buckets | path buckets | records ...
+ *
+ * Buckets hold the offsets of the first record of a hash chain, keyed by
+ * the trash name of an entry and by its original Path=. Records are only
+ * ever appended; a removed record is unlinked from both chains and marked
+ * dead. The catalog records the mtime of Trash/info it was built from. When
+ * they differ, the catalog is rebuilt from info/, re-reading only those
+ * .trashinfo files whose mtime changed. Other ptrash processes are kept out
+ * with flock(2) and the threads of this one with a mutex.
+ *
+ * Each record also holds the disk usage of its file, and the header their
+ * sum, so that the usage of the trash is known without walking it. Sizes of
+ * directories are shared with other trash implementations through the
+ * FreeDesktop Trash/directorysizes cache.
+ *
+ * Records are kept in the order of their DeletionDate: a rebuild sorts
+ * them, and new entries are deleted now, after all the others. The record
+ * heap is thus a queue of entries by age; the header points at the oldest
+ * live record, so that eviction costs time in proportion to the entries
+ * it removes. Should the clock go back, the catalog is marked unsorted
+ * and the next eviction rebuilds it.
+ */
+
+#include <ptrash.h>
+#include <ptrashdb.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/file.h>       /* for flock */
+#include <sys/mman.h>       /* for mmap */
+
+#define C_MAGIC         "PTRASHC3"
+#define C_MINBKT        1024
+#define C_CHUNK         (1024 * 1024)
+#define C_DEAD          1
+#define C_DIR           2
+#define C_DENTSZ        (1024 * 1024)   /* getdents64 buffer for info/ */
+#define C_SCANMIN       1024            /* entries worth a thread */
+#define C_THREADS       16
+
+/* catalog file header */
+typedef struct
+{
+    char magic[8];
+    uint32_t nbucket;
+    uint32_t stale;         /* replaced by a rebuilt catalog, reopen it */
+    uint64_t nlive;         /* records in use */
+    uint64_t ndead;         /* records removed */
+    uint64_t end;           /* end of the last record */
+    int64_t isec, insec;    /* mtime of Trash/info the catalog matches */
+    int64_t total;          /* bytes used by the entries of known size */
+    uint64_t nunknown;      /* entries of unknown size */
+    uint64_t head;          /* oldest record, dead ones may lie before it */
+    int64_t last;           /* DeletionDate of the last record */
+    uint32_t unsorted;      /* records are not in the order of their date */
+    uint32_t pad;
+} chdr;
+
+/* an entry of the catalog, followed by its name and path strings */
+typedef struct
+{
+    uint64_t nnext;         /* next record in the name chain, 0 at the end */
+    uint64_t pnext;         /* next record in the path chain */
+    int64_t date;           /* DeletionDate, seconds since the epoch */
+    int64_t msec, mnsec;    /* mtime of the .trashinfo file */
+    int64_t size;           /* disk usage of the trashed file, -1 if not known */
+    uint32_t nlen, plen;    /* lengths of name and path */
+    uint32_t flags;         /* C_DEAD, C_DIR */
+    uint32_t pad;
+    char str[];             /* name NUL path NUL */
+} crec;
+
+/* a .trashinfo file being stat-ed */
+typedef struct
+{
+    int res;
+    struct statx stx;
+    char name[NAME_MAX + 1];
+} cstat;
+
+/* an entry of Trash/info read by a rebuild */
+typedef struct
+{
+    char *name;             /* .trashinfo file name */
+    char *path;             /* original path, NULL if not read */
+    time_t date;
+    int64_t size;
+    uint32_t flags;
+    short parsed;           /* not found in the old catalog */
+    struct timespec mt;     /* mtime of the .trashinfo file */
+} cent;
+
+/* an entry of Trash/directorysizes */
+typedef struct
+{
+    char *name;
+    int64_t size;
+    int64_t mtime;          /* of the .trashinfo file, in seconds */
+} dsize;
+
+/* a part of the entries, scanned by one thread */
+typedef struct
+{
+    struct catalog *old;    /* catalog being rebuilt, NULL if not valid */
+    int ifd, ffd;
+    dsize *ds;              /* sorted by name */
+    size_t nds;
+    cent *e;
+    size_t from, to;
+} cscan;
+
+struct catalog
+{
+    pthread_mutex_t lock;
+    int fd;                 /* catalog file */
+    int ifd;                /* Trash/info directory */
+    int ffd;                /* Trash/files directory */
+    char *file;
+    char *dsfile;           /* Trash/directorysizes */
+    unsigned char *map;
+    size_t mapsz;
+    short fresh;            /* catalog matched info/ at c_begin */
+};
+
+#define HDR(c)          ((chdr *)(c)->map)
+#define NBKT(c)         ((uint64_t *)((c)->map + sizeof (chdr)))
+#define PBKT(c)         (NBKT (c) + HDR (c)->nbucket)
+#define REC(c, o)       ((crec *)((c)->map + (o)))
+#define RNAME(r)        ((r)->str)
+#define RPATH(r)        ((r)->str + (r)->nlen + 1)
+#define ALIGN8(n)       (((n) + 7) & ~(size_t)7)
+
+
+/* FNV-1a hash of a string */
+static uint64_t
+c_hash (const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+
+/* c_unescape: decode the %XX escapes of a directorysizes name, in place */
+static void
+c_unescape (char *s)
+{
+    char *d = s;
+    unsigned int x = 0;
+
+    for (; *s; s++)
+    {
+        if (*s == '%' && isxdigit (s[1]) && isxdigit (s[2])
+            && sscanf (s + 1, "%2x", &x) == 1)
+        {
+            *d++ = x;
+            s += 2;
+        }
+        else
+            *d++ = *s;
+    }
+    *d = '\0';
+}
+
+
+/* c_escape: print a directorysizes name, escaping reserved characters */
+static void
+c_escape (FILE *out, const char *s)
+{
+    for (; *s; s++)
+    {
+        if (isalnum ((unsigned char)*s) || strchr ("-._~", *s))
+            fputc (*s, out);
+        else
+            fprintf (out, "%%%02X", (unsigned char)*s);
+    }
+}
+
+
+static int
+ds_cmp (const void *a, const void *b)
+{
+    return strcmp (((const dsize *) a)->name, ((const dsize *) b)->name);
+}
+
+
+/*
+ * c_dsload: read Trash/directorysizes, lines of size, .trashinfo mtime and
+ * escaped directory name. Returns its entries sorted by name, or NULL.
+ */
+static dsize *
+c_dsload (catalog *c, size_t *n)
+{
+    int off = 0;
+    FILE *fp = NULL;
+    dsize *ds = NULL;
+    char *ln = NULL;
+    size_t sz = 0, cap = 0;
+    long long size = 0, mtime = 0;
+
+    *n = 0;
+    if ((fp = fopen (c->dsfile, "re")) == NULL)
+        return NULL;
+    while (getline (&ln, &sz, fp) > 0)
+    {
+        ln[strcspn (ln, "\n")] = '\0';
+        if (sscanf (ln, "%lld %lld %n", &size, &mtime, &off) < 2 || !ln[off])
+            continue;
+        if (*n == cap)
+        {
+            dsize *p = realloc (ds, (cap = cap ? cap * 2 : 64) * sizeof (dsize));
+            if (p == NULL)
+                break;
+            ds = p;
+        }
+        if ((ds[*n].name = strdup (ln + off)) == NULL)
+            break;
+        c_unescape (ds[*n].name);
+        ds[*n].size = size;
+        ds[*n].mtime = mtime;
+        (*n)++;
+    }
+    free (ln);
+    fclose (fp);
+    if (ds != NULL)
+        qsort (ds, *n, sizeof (dsize), ds_cmp);
+
+    return ds;
+}
+
+
+/* c_dsfind: cached size of directory @name, if its record is unchanged */
+static int64_t
+c_dsfind (cscan *s, const char *name, int64_t mtime)
+{
+    dsize k, *d = NULL;
+
+    k.name = (char *) name;
+    if (s->ds == NULL
+        || (d = bsearch (&k, s->ds, s->nds, sizeof (dsize), ds_cmp)) == NULL)
+        return -1;
+
+    return d->mtime == mtime ? d->size : -1;
+}
+
+
+/*
+ * c_map: map the catalog file, all of it. Returns 0 on success and -1 on
+ * error.
+ */
+static int
+c_map (catalog *c)
+{
+    struct stat st;
+
+    if (fstat (c->fd, &st) < 0 || (size_t) st.st_size < sizeof (chdr))
+        return -1;
+    if (c->map != NULL && c->mapsz == (size_t) st.st_size)
+        return 0;
+
+    if (c->map != NULL)
+        munmap (c->map, c->mapsz);
+    c->mapsz = st.st_size;
+    c->map = mmap (NULL, c->mapsz, PROT_READ|PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if (c->map == MAP_FAILED)
+        c->map = NULL;
+
+    return c->map ? 0 : -1;
+}
+
+
+/* returns 1 when the mapped file is a valid catalog */
+static int
+c_valid (catalog *c)
+{
+    return c->map != NULL && !memcmp (HDR (c)->magic, C_MAGIC, 8)
+           && HDR (c)->end <= c->mapsz
+           && sizeof (chdr) + 2 * HDR (c)->nbucket * 8 <= HDR (c)->end;
+}
+
+
+/*
+ * c_lock: take the catalog for an operation. Follows the catalog file when
+ * another process has replaced it with a rebuilt one. Returns 0 on success
+ * and -1 if the catalog is not usable; it is rebuilt in that case when
+ * @how is LOCK_EX.
+ */
+static int
+c_lock (catalog *c, int how)
+{
+    int fd = -1;
+
+    pthread_mutex_lock (&c->lock);
+    for (;;)
+    {
+        if (c->fd < 0 && (c->fd = open (c->file, O_RDWR|O_CREAT|O_CLOEXEC,
+                                        S_IRUSR|S_IWUSR)) < 0)
+            return -1;
+        flock (c->fd, how);
+        if (c_map (c) < 0 || !c_valid (c))
+        {
+            if (c->map != NULL)
+                munmap (c->map, c->mapsz);
+            c->map = NULL;
+            return -1;
+        }
+        if (!HDR (c)->stale)
+            return 0;
+
+        /* replaced by a rebuilt catalog */
+        fd = c->fd;
+        munmap (c->map, c->mapsz);
+        c->map = NULL;
+        c->fd = -1;
+        close (fd);
+    }
+}
+
+
+static void
+c_unlock (catalog *c)
+{
+    if (c->fd >= 0)
+        flock (c->fd, LOCK_UN);
+    pthread_mutex_unlock (&c->lock);
+}
+
+
+/*
+ * c_find: returns the offset of the live record named @name, or 0.
+ */
+static uint64_t
+c_find (catalog *c, const char *name)
+{
+    uint64_t o = NBKT (c)[c_hash (name) & (HDR (c)->nbucket - 1)];
+
+    while (o && strcmp (RNAME (REC (c, o)), name))
+        o = REC (c, o)->nnext;
+
+    return o;
+}
+
+
+/*
+ * c_append: append a record to the catalog and link it into the hash
+ * chains. Returns 0 on success and -1 on error.
+ */
+static int
+c_append (catalog *c, const char *name, const char *path, time_t date,
+          const struct timespec *mtime, int64_t size, uint32_t flags)
+{
+    crec *r = NULL;
+    uint64_t o = 0, *b = NULL;
+    size_t nl = strlen (name), pl = strlen (path);
+    size_t need = ALIGN8 (sizeof (crec) + nl + pl + 2);
+    uint32_t mask = HDR (c)->nbucket - 1;
+
+    if (HDR (c)->end + need > c->mapsz)
+    {
+        off_t sz = (HDR (c)->end + need + C_CHUNK) & ~(off_t)(C_CHUNK - 1);
+
+        if (ftruncate (c->fd, sz) < 0 || c_map (c) < 0)
+            return -1;
+    }
+
+    o = HDR (c)->end;
+    r = REC (c, o);
+    memset (r, 0, sizeof (crec));
+    r->date = date;
+    r->msec = mtime ? mtime->tv_sec : 0;
+    r->mnsec = mtime ? mtime->tv_nsec : 0;
+    r->size = size;
+    r->flags = flags;
+    r->nlen = nl;
+    r->plen = pl;
+    memcpy (RNAME (r), name, nl + 1);
+    memcpy (RPATH (r), path, pl + 1);
+
+    b = &NBKT (c)[c_hash (name) & mask];
+    r->nnext = *b;
+    *b = o;
+    b = &PBKT (c)[c_hash (path) & mask];
+    r->pnext = *b;
+    *b = o;
+
+    if (date < HDR (c)->last)
+        HDR (c)->unsorted = 1;
+    HDR (c)->last = date;
+    HDR (c)->end += need;
+    HDR (c)->nlive++;
+    if (size >= 0)
+        HDR (c)->total += size;
+    else
+        HDR (c)->nunknown++;
+
+    return 0;
+}
+
+
+/*
+ * c_unlink: remove the record at offset @o from both hash chains.
+ */
+static void
+c_unlink (catalog *c, uint64_t o)
+{
+    crec *r = REC (c, o);
+    uint32_t mask = HDR (c)->nbucket - 1;
+    uint64_t *p = &NBKT (c)[c_hash (RNAME (r)) & mask];
+
+    while (*p && *p != o)
+        p = &REC (c, *p)->nnext;
+    if (*p)
+        *p = r->nnext;
+
+    p = &PBKT (c)[c_hash (RPATH (r)) & mask];
+    while (*p && *p != o)
+        p = &REC (c, *p)->pnext;
+    if (*p)
+        *p = r->pnext;
+
+    r->flags |= C_DEAD;
+    HDR (c)->nlive--;
+    HDR (c)->ndead++;
+    if (r->size >= 0)
+        HDR (c)->total -= r->size;
+    else
+        HDR (c)->nunknown--;
+}
+
+
+/*
+ * c_init: lay out an empty catalog for about @n entries in the file @fd.
+ */
+static int
+c_init (catalog *c, int fd, size_t n)
+{
+    uint32_t nb = C_MINBKT;
+    size_t sz = 0;
+
+    while (nb < 2 * n)
+        nb *= 2;
+    sz = sizeof (chdr) + 2 * nb * sizeof (uint64_t);
+    if (ftruncate (fd, sz + n * 128 + C_CHUNK) < 0)
+        return -1;
+
+    c->fd = fd;
+    c->map = NULL;
+    if (c_map (c) < 0)
+        return -1;
+
+    memset (c->map, 0, sz);
+    memcpy (HDR (c)->magic, C_MAGIC, 8);
+    HDR (c)->nbucket = nb;
+    HDR (c)->end = HDR (c)->head = sz;
+
+    return 0;
+}
+
+
+/*
+ * c_scan: stat one part of the entries of Trash/info, and read the path and
+ * date of those not found unchanged in the old catalog.
+ */
+static void
+c_scan (cscan *s)
+{
+    cstat *st = NULL;
+    iobatch *b = iob_get ();
+    size_t i = 0, j = 0, n = 0;
+
+    if ((st = malloc (IOB_DEPTH * sizeof (cstat))) == NULL)
+        return;
+    for (i = s->from; i < s->to; i += n)
+    {
+        /* stat a batch of records with one submission */
+        n = s->to - i < IOB_DEPTH ? s->to - i : IOB_DEPTH;
+        for (j = 0; j < n; j++)
+            iob_statx (b, s->ifd, s->e[i + j].name, AT_SYMLINK_NOFOLLOW,
+                       STATX_MTIME, &st[j].stx, &st[j].res);
+        iob_submit (b);
+
+        for (j = 0; j < n; j++)
+        {
+            crec *r = NULL;
+            uint64_t o = 0;
+            cent *e = &s->e[i + j];
+            size_t l = strlen (e->name) - 10;
+
+            if (st[j].res < 0)
+                continue;
+            e->mt.tv_sec = st[j].stx.stx_mtime.tv_sec;
+            e->mt.tv_nsec = st[j].stx.stx_mtime.tv_nsec;
+
+            e->name[l] = '\0';
+            if (s->old != NULL && (o = c_find (s->old, e->name)))
+                r = REC (s->old, o);
+            if (r != NULL && r->msec == e->mt.tv_sec
+                && r->mnsec == e->mt.tv_nsec)
+            {
+                e->path = strdup (RPATH (r));
+                e->date = r->date;
+                e->size = r->size;
+                e->flags = r->flags & C_DIR;
+            }
+            else
+            {
+                e->name[l] = '.';
+                e->parsed = !t_parse (s->ifd, e->name, &e->path, &e->date);
+                e->name[l] = '\0';
+            }
+        }
+
+        /* disk usage of the files of records read afresh */
+        for (j = 0; j < n; j++)
+            if (s->e[i + j].parsed)
+                iob_statx (b, s->ffd, s->e[i + j].name, AT_SYMLINK_NOFOLLOW,
+                           STATX_TYPE|STATX_BLOCKS, &st[j].stx, &st[j].res);
+        iob_submit (b);
+        for (j = 0; j < n; j++)
+        {
+            cent *e = &s->e[i + j];
+
+            if (!e->parsed || st[j].res < 0)
+                continue;
+            if (S_ISDIR (st[j].stx.stx_mode))
+            {
+                e->flags |= C_DIR;
+                e->size = c_dsfind (s, e->name, e->mt.tv_sec);
+            }
+            else
+                e->size = st[j].stx.stx_blocks * 512LL;
+        }
+    }
+    free (st);
+}
+
+
+/* order of entries in a rebuilt catalog, oldest first */
+static int
+cent_cmp (const void *a, const void *b)
+{
+    const cent *x = a, *y = b;
+
+    if (x->date != y->date)
+        return x->date < y->date ? -1 : 1;
+
+    return strcmp (x->name, y->name);
+}
+
+
+static void *
+c_scan_thread (void *arg)
+{
+    c_scan (arg);
+    iob_put ();
+
+    return NULL;
+}
+
+
+/*
+ * c_rebuild: build a new catalog from Trash/info. Records of the current
+ * catalog are reused for the .trashinfo files whose mtime is unchanged, the
+ * others are parsed afresh, on all the CPUs. The new catalog replaces the
+ * old one atomically. Called with the catalog locked. Returns 0 on success
+ * and -1 on error.
+ */
+static int
+c_rebuild (catalog *c)
+{
+    dents *d = NULL;
+    struct stat st;
+    catalog old = *c;
+    dsize *ds = NULL;
+    cent *ents = NULL;
+    cscan *scan = NULL;
+    pthread_t *tid = NULL;
+    struct dirent64 *de = NULL;
+    char *tmp = NULL, *names = NULL;
+    int fd = -1, ret = -1;
+    long i = 0, nt = 1;
+    size_t n = 0, cap = 0, nsz = 0, ncap = 0, nds = 0;
+
+    if (fstat (c->ifd, &st) < 0
+        || (d = dents_open (c->ifd, C_DENTSZ)) == NULL)
+        return -1;
+    lseek (c->ifd, 0, SEEK_SET);
+    while ((de = dents_read (d)) != NULL)
+    {
+        size_t l = strlen (de->d_name) + 1;
+
+        if (l <= 11 || strcmp (&de->d_name[l - 11], ".trashinfo"))
+            continue;
+        if (n == cap)
+        {
+            cent *e = realloc (ents, (cap = cap ? cap * 2 : 1024)
+                                     * sizeof (cent));
+            if (e == NULL)
+                goto out;
+            ents = e;
+        }
+        if (nsz + l > ncap)
+        {
+            char *p = realloc (names, (ncap = ncap ? ncap * 2 : 64 * 1024));
+            if (p == NULL)
+                goto out;
+            names = p;
+        }
+        memset (&ents[n], 0, sizeof (cent));
+        ents[n].size = -1;
+        ents[n++].name = (char *)(uintptr_t) nsz;    /* until names settle */
+        memcpy (names + nsz, de->d_name, l);
+        nsz += l;
+    }
+    dents_close (d);
+    d = NULL;
+    for (i = 0; i < (long) n; i++)
+        ents[i].name = names + (uintptr_t) ents[i].name;
+    ds = c_dsload (c, &nds);
+
+    /* a thread per CPU for the entries to stat and parse */
+    if (n >= C_SCANMIN && (nt = sysconf (_SC_NPROCESSORS_ONLN)) > 1)
+    {
+        if (nt > C_THREADS)
+            nt = C_THREADS;
+        if ((long) n < nt * C_SCANMIN)
+            nt = n / C_SCANMIN;
+    }
+    if (nt < 1)
+        nt = 1;
+    if ((scan = calloc (nt, sizeof (cscan))) == NULL
+        || (tid = calloc (nt, sizeof (pthread_t))) == NULL)
+        goto out;
+    for (i = 0; i < nt; i++)
+    {
+        scan[i].old = old.map != NULL ? &old : NULL;
+        scan[i].ifd = c->ifd;
+        scan[i].ffd = c->ffd;
+        scan[i].ds = ds;
+        scan[i].nds = nds;
+        scan[i].e = ents;
+        scan[i].from = n * i / nt;
+        scan[i].to = n * (i + 1) / nt;
+        if (i && pthread_create (&tid[i], NULL, c_scan_thread, &scan[i]))
+        {
+            c_scan (&scan[i]);
+            tid[i] = 0;
+        }
+    }
+    c_scan (&scan[0]);
+    for (i = 1; i < nt; i++)
+        if (tid[i])
+            pthread_join (tid[i], NULL);
+
+    /* lay out the new catalog */
+    if ((tmp = malloc (strlen (c->file) + 16)) == NULL)
+        goto out;
+    sprintf (tmp, "%s.%d", c->file, (int) getpid ());
+    if ((fd = open (tmp, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR)) < 0)
+        goto out;
+
+    c->map = NULL;
+    if (c_init (c, fd, n) < 0)
+        goto fail;
+    HDR (c)->isec = st.st_mtim.tv_sec;
+    HDR (c)->insec = st.st_mtim.tv_nsec;
+    qsort (ents, n, sizeof (cent), cent_cmp);
+    for (i = 0; i < (long) n; i++)
+    {
+        cent *e = &ents[i];
+
+        if (e->path != NULL && c_append (c, e->name, e->path, e->date, &e->mt,
+                                         e->size, e->flags) < 0)
+            goto fail;
+    }
+
+    if (rename (tmp, c->file) < 0)
+        goto fail;
+    if (old.map != NULL)
+    {
+        HDR (&old)->stale = 1;
+        munmap (old.map, old.mapsz);
+    }
+    if (old.fd >= 0)
+    {
+        flock (old.fd, LOCK_UN);
+        close (old.fd);
+    }
+    flock (c->fd, LOCK_EX);
+    ret = 0;
+    goto out;
+
+fail:
+    warnx ("could not rebuild catalog `%s'", c->file);
+    if (c->map != NULL)
+        munmap (c->map, c->mapsz);
+    unlink (tmp);
+    close (fd);
+    c->fd = old.fd;
+    c->map = old.map;
+    c->mapsz = old.mapsz;
+out:
+    if (d != NULL)
+        dents_close (d);
+    for (i = 0; ents != NULL && i < (long) n; i++)
+        free (ents[i].path);
+    free (ents);
+    free (names);
+    while (nds)
+        free (ds[--nds].name);
+    free (ds);
+    free (scan);
+    free (tid);
+    free (tmp);
+    return ret;
+}
+
+
+/*
+ * c_open: open the catalog of the trash info directory @info, creating it
+ * when needed. Returns NULL if the catalog can not be used, callers then
+ * read Trash/info directly.
+ */
+catalog *
+c_open (const char *info)
+{
+    catalog *c = NULL;
+
+    assert (info != NULL);
+
+    if ((c = calloc (1, sizeof (catalog))) == NULL)
+        return NULL;
+    pthread_mutex_init (&c->lock, NULL);
+    c->fd = -1;
+    c->ifd = open (info, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    c->ffd = openat (c->ifd, "../files", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    c->file = build_path (info, "../ptrash.catalog");
+    c->dsfile = build_path (info, "../directorysizes");
+    if (c->ifd < 0 || c->ffd < 0 || c->file == NULL || c->dsfile == NULL)
+        goto err;
+
+    if (c_lock (c, LOCK_EX) < 0 && (c->fd < 0 || c_rebuild (c) < 0))
+    {
+        c_unlock (c);
+        goto err;
+    }
+    c_unlock (c);
+
+    return c;
+
+err:
+    if (c->ifd >= 0)
+        close (c->ifd);
+    if (c->ffd >= 0)
+        close (c->ffd);
+    free (c->file);
+    free (c->dsfile);
+    free (c);
+    return NULL;
+}
+
+
+/*
+ * c_detach: give the catalog descriptors of its own, in a child of ptrashd.
+ * Those inherited from the server share its flock(2) lock and the offset of
+ * info/ with the other children.
+ */
+void
+c_detach (catalog *c)
+{
+    int fd = -1;
+
+    assert (c != NULL);
+
+    if (c->map != NULL)
+        munmap (c->map, c->mapsz);
+    c->map = NULL;
+    if (c->fd >= 0)
+        close (c->fd);
+    c->fd = -1;     /* opened again by c_lock */
+    if ((fd = openat (c->ifd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC)) >= 0)
+    {
+        close (c->ifd);
+        c->ifd = fd;
+    }
+}
+
+
+/*
+ * c_fresh: returns 1 when the catalog matches the current Trash/info.
+ */
+static int
+c_fresh (catalog *c)
+{
+    struct stat st;
+
+    if (fstat (c->ifd, &st) < 0)
+        return 0;
+
+    return HDR (c)->isec == st.st_mtim.tv_sec
+           && HDR (c)->insec == st.st_mtim.tv_nsec;
+}
+
+
+/*
+ * c_refresh: bring the catalog up to date with Trash/info. It is rebuilt
+ * when info/ has changed behind its back, or has too many dead records.
+ * Returns 0 on success and -1 on error.
+ */
+int
+c_refresh (catalog *c)
+{
+    int ret = 0;
+
+    assert (c != NULL);
+
+    if (c_lock (c, LOCK_EX) < 0)
+    {
+        ret = c->fd >= 0 ? c_rebuild (c) : -1;
+        c_unlock (c);
+        return ret;
+    }
+    if (!c_fresh (c) || HDR (c)->ndead > HDR (c)->nlive + C_MINBKT
+        || HDR (c)->nlive > 4 * (uint64_t) HDR (c)->nbucket)
+        ret = c_rebuild (c);
+    c_unlock (c);
+
+    return ret;
+}
+
+
+/*
+ * c_begin: lock the catalog before ptrash itself changes Trash/info, so that
+ * the change is recorded by c_insert or c_remove. Must be paired with c_end.
+ */
+void
+c_begin (catalog *c)
+{
+    assert (c != NULL);
+
+    if (c_lock (c, LOCK_EX) < 0)
+        c->fresh = 0;
+    else
+        c->fresh = c_fresh (c);
+}
+
+
+/*
+ * c_end: unlock the catalog after a change of Trash/info. If the catalog
+ * was up to date before the change, it is marked up to date again.
+ */
+void
+c_end (catalog *c)
+{
+    struct stat st;
+
+    assert (c != NULL);
+
+    if (c->fresh && c->map != NULL && !fstat (c->ifd, &st))
+    {
+        HDR (c)->isec = st.st_mtim.tv_sec;
+        HDR (c)->insec = st.st_mtim.tv_nsec;
+    }
+    c->fresh = 0;
+    c_unlock (c);
+}
+
+
+/*
+ * c_insert: record a new entry of Trash/info, between c_begin and c_end.
+ * Returns 0 on success and -1 on error.
+ *
+ * e: the entry; its name, original path, deletion date, size and type.
+ * mtime: mtime of its .trashinfo file.
+ */
+int
+c_insert (catalog *c, const centry *e, const struct timespec *mtime)
+{
+    uint64_t o = 0;
+
+    assert (c != NULL && e != NULL && e->name != NULL && e->path != NULL);
+
+    if (c->map == NULL)
+        return -1;
+    if ((o = c_find (c, e->name)))
+        c_unlink (c, o);
+
+    return c_append (c, e->name, e->path, e->date, mtime, e->size,
+                     e->dir ? C_DIR : 0);
+}
+
+
+/*
+ * c_remove: forget an entry removed from Trash/info, between c_begin and
+ * c_end. Returns 1 if it was a directory, 0 if not and -1 if it was not in
+ * the catalog.
+ */
+int
+c_remove (catalog *c, const char *name)
+{
+    uint64_t o = 0;
+
+    assert (c != NULL && name != NULL);
+
+    if (c->map == NULL || !(o = c_find (c, name)))
+        return -1;
+    c_unlink (c, o);
+
+    return !!(REC (c, o)->flags & C_DIR);
+}
+
+
+/*
+ * c_setsize: record the disk usage of the entry @name, once it is counted.
+ * Returns 0 on success and -1 if it is not in the catalog.
+ */
+int
+c_setsize (catalog *c, const char *name, long long size)
+{
+    crec *r = NULL;
+    uint64_t o = 0;
+
+    assert (c != NULL && name != NULL);
+
+    if (c_lock (c, LOCK_EX) < 0 || !(o = c_find (c, name)))
+    {
+        c_unlock (c);
+        return -1;
+    }
+    r = REC (c, o);
+    if (r->size >= 0)
+        HDR (c)->total -= r->size;
+    else
+        HDR (c)->nunknown--;
+    if ((r->size = size) >= 0)
+        HDR (c)->total += size;
+    else
+        HDR (c)->nunknown++;
+    c_unlock (c);
+
+    return 0;
+}
+
+
+/*
+ * c_usage: returns the bytes used by the entries of known size, and sets
+ * @unknown to the number of entries whose size is not known, or -1 on
+ * error. Needs no walk of the trash.
+ */
+long long
+c_usage (catalog *c, long *unknown)
+{
+    long long ret = -1;
+
+    assert (c != NULL && unknown != NULL);
+
+    if (c_refresh (c) < 0 || c_lock (c, LOCK_SH) < 0)
+    {
+        c_unlock (c);
+        return -1;
+    }
+    ret = HDR (c)->total;
+    *unknown = HDR (c)->nunknown;
+    c_unlock (c);
+
+    return ret;
+}
+
+
+/*
+ * c_dirsizes: write the sizes of the directories in trash to the
+ * FreeDesktop Trash/directorysizes cache, replacing it atomically.
+ * Returns 0 on success and -1 on error.
+ */
+int
+c_dirsizes (catalog *c)
+{
+    uint64_t o = 0;
+    FILE *fp = NULL;
+    char *tmp = NULL;
+    int fd = -1, ret = -1;
+
+    assert (c != NULL);
+
+    if ((tmp = malloc (strlen (c->dsfile) + 16)) == NULL)
+        return -1;
+    sprintf (tmp, "%s.%d", c->dsfile, (int) getpid ());
+    if (c_lock (c, LOCK_SH) < 0)
+        goto out;
+    /* ptrash runs with umask 0, the cache is private like the catalog */
+    if ((fd = open (tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+                    S_IRUSR|S_IWUSR)) < 0 || (fp = fdopen (fd, "w")) == NULL)
+    {
+        if (fd >= 0)
+        {
+            close (fd);
+            unlink (tmp);
+        }
+        goto out;
+    }
+
+    o = sizeof (chdr) + 2 * HDR (c)->nbucket * sizeof (uint64_t);
+    while (o < HDR (c)->end)
+    {
+        crec *r = REC (c, o);
+
+        if (!(r->flags & C_DEAD) && (r->flags & C_DIR) && r->size >= 0)
+        {
+            fprintf (fp, "%lld %lld ", (long long) r->size,
+                     (long long) r->msec);
+            c_escape (fp, RNAME (r));
+            fputc ('\n', fp);
+        }
+        o += ALIGN8 (sizeof (crec) + r->nlen + r->plen + 2);
+    }
+    if (fclose (fp) || rename (tmp, c->dsfile) < 0)
+        unlink (tmp);
+    else
+        ret = 0;
+
+out:
+    c_unlock (c);
+    if (ret < 0)
+        warnx ("could not write `%s'", c->dsfile);
+    free (tmp);
+    return ret;
+}
+
+
+/*
+ * c_oldest: fill @e with the oldest entry of the trash; its name is a copy
+ * to be freed by the caller, the path is not set. Returns 0 on success and
+ * -1 if the trash is empty.
+ */
+int
+c_oldest (catalog *c, centry *e)
+{
+    crec *r = NULL;
+    int ret = -1;
+
+    assert (c != NULL && e != NULL);
+
+    if (c_refresh (c) < 0 || c_lock (c, LOCK_EX) < 0
+        || (HDR (c)->unsorted && c_rebuild (c) < 0))
+    {
+        c_unlock (c);
+        return -1;
+    }
+    while (HDR (c)->head < HDR (c)->end)
+    {
+        r = REC (c, HDR (c)->head);
+        if (!(r->flags & C_DEAD))
+        {
+            memset (e, 0, sizeof (centry));
+            e->name = strdup (RNAME (r));
+            e->date = r->date;
+            e->size = r->size;
+            e->dir = !!(r->flags & C_DIR);
+            ret = e->name != NULL ? 0 : -1;
+            break;
+        }
+        HDR (c)->head += ALIGN8 (sizeof (crec) + r->nlen + r->plen + 2);
+    }
+    c_unlock (c);
+
+    return ret;
+}
+
+
+/*
+ * c_lookup: returns a copy of the original path of the trash entry @name,
+ * or NULL if it is not in the catalog.
+ */
+char *
+c_lookup (catalog *c, const char *name)
+{
+    uint64_t o = 0;
+    char *ret = NULL;
+
+    assert (c != NULL && name != NULL);
+
+    if (c_refresh (c) < 0 || c_lock (c, LOCK_SH) < 0)
+    {
+        c_unlock (c);
+        return NULL;
+    }
+    if ((o = c_find (c, name)))
+        ret = strdup (RPATH (REC (c, o)));
+    c_unlock (c);
+
+    return ret;
+}
+
+
+/*
+ * c_lookup_path: returns a copy of the trash name of the most recently
+ * deleted entry whose original path is @path, or NULL if there is none.
+ */
+char *
+c_lookup_path (catalog *c, const char *path)
+{
+    uint64_t o = 0;
+    crec *r = NULL, *best = NULL;
+    char *ret = NULL;
+
+    assert (c != NULL && path != NULL);
+
+    if (c_refresh (c) < 0 || c_lock (c, LOCK_SH) < 0)
+    {
+        c_unlock (c);
+        return NULL;
+    }
+    for (o = PBKT (c)[c_hash (path) & (HDR (c)->nbucket - 1)]; o; o = r->pnext)
+    {
+        r = REC (c, o);
+        if (!strcmp (RPATH (r), path) && (best == NULL || r->date > best->date))
+            best = r;
+    }
+    if (best != NULL)
+        ret = strdup (RNAME (best));
+    c_unlock (c);
+
+    return ret;
+}
+
+
+/*
+ * c_foreach: call @fn for every entry of the catalog, with the catalog
+ * locked; @fn must not call back into the catalog. Returns the number of
+ * entries, or -1 on error.
+ */
+long
+c_foreach (catalog *c, void (*fn) (const centry *, void *), void *arg)
+{
+    long n = 0;
+    uint64_t o = 0;
+    centry e;
+
+    assert (c != NULL && fn != NULL);
+
+    if (c_refresh (c) < 0 || c_lock (c, LOCK_SH) < 0)
+    {
+        c_unlock (c);
+        return -1;
+    }
+    o = sizeof (chdr) + 2 * HDR (c)->nbucket * sizeof (uint64_t);
+    while (o < HDR (c)->end)
+    {
+        crec *r = REC (c, o);
+
+        if (!(r->flags & C_DEAD))
+        {
+            e.name = RNAME (r);
+            e.path = RPATH (r);
+            e.date = r->date;
+            e.size = r->size;
+            e.dir = !!(r->flags & C_DIR);
+            fn (&e, arg);
+            n++;
+        }
+        o += ALIGN8 (sizeof (crec) + r->nlen + r->plen + 2);
+    }
+    c_unlock (c);
+
+    return n;
+}
@@ -0,0 +1,517 @@
+/*
+ * copy.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <ptrash.h>
+#include <sys/ioctl.h>      /* for ioctl, FICLONE */
+#ifdef HAVE_SYS_SENDFILE_H
+    #include <sys/sendfile.h>
+#endif
+
+#define COPYSZ          (8 * 1024 * 1024)
+#define BUFMIN          (1024 * 1024)       /* buffer of read/write copies */
+#define BUFMAX          (16 * 1024 * 1024)
+#define DROPSZ          (32 * 1024 * 1024)  /* copied between cache drops */
+#define DIO_ALIGN       4096                /* of O_DIRECT buffers, offsets */
+#define CKPT_SZ         (256 * 1024 * 1024) /* copied between journal marks */
+
+short cdirect = 0;          /* --direct: copy large files with O_DIRECT */
+
+/* progress of the file being copied */
+typedef struct
+{
+    off_t size;
+    off_t done;             /* data copied, holes are not */
+    off_t pos;              /* offset the file is copied up to */
+    int src, dst;
+    short prep;             /* data goes through the cache, see c_prep */
+    off_t wb;               /* writeback of dst started up to here */
+    off_t dropped;          /* pages dropped from the cache up to here */
+    tjob *job;              /* journal of the move, for large files */
+    const struct stat *sb;  /* of src */
+    off_t mark;             /* offset last journaled */
+} progress;
+
+/*
+ * copy engine: copies from the current offset of src to dst. Returns 1 when
+ * successful, 0 if the engine is not supported for this pair of files and
+ * the next one should be tried, or -1 on error.
+ */
+typedef struct
+{
+    const char *name;
+    int (*copy) (int, int, progress *);
+} engine;
+
+
+/*
+ * c_drop: drop the pages of both files copied up to @end from the page
+ * cache, as neither the source, soon removed, nor its copy in trash is read
+ * again, and they would push out the pages of other programs. Writeback of
+ * the copy is started up to @end, and waited for up to where it was started
+ * the last time, so that the copy does not wait for each write.
+ */
+static void
+c_drop (progress *pg, off_t end)
+{
+    if (!pg->prep)
+        return;
+#ifdef HAVE_SYNC_FILE_RANGE
+    sync_file_range (pg->dst, pg->wb, end - pg->wb, SYNC_FILE_RANGE_WRITE);
+    if (pg->dropped < pg->wb)
+        sync_file_range (pg->dst, pg->dropped, pg->wb - pg->dropped,
+                         SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE
+                         |SYNC_FILE_RANGE_WAIT_AFTER);
+    st_sys (2);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+    if (pg->dropped < pg->wb)
+    {
+        posix_fadvise (pg->dst, pg->dropped, pg->wb - pg->dropped,
+                       POSIX_FADV_DONTNEED);
+        posix_fadvise (pg->src, pg->dropped, pg->wb - pg->dropped,
+                       POSIX_FADV_DONTNEED);
+        st_sys (2);
+    }
+#endif
+    pg->dropped = pg->wb;
+    pg->wb = end;
+}
+
+
+/*
+ * c_prep: ready the copy of a file of BUFMIN bytes or more, once, before the
+ * first engine that moves its data through the page cache: the source is to
+ * be read sequentially, and with @alloc set the blocks of the copy are
+ * allocated up front, in few extents, without changing its size until the
+ * data is in. Smaller files are not worth the system calls.
+ */
+static void
+c_prep (progress *pg, short alloc)
+{
+    if (pg->prep || pg->size < BUFMIN)
+        return;
+    pg->prep = 1;
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise (pg->src, 0, 0, POSIX_FADV_SEQUENTIAL);
+    st_sys (1);
+#endif
+#ifdef HAVE_FALLOCATE
+    if (alloc)
+    {
+        fallocate (pg->dst, FALLOC_FL_KEEP_SIZE, 0, pg->size);
+        st_sys (1);
+    }
+#endif
+}
+
+
+/*
+ * c_buf: returns a buffer for the read/write copy of @size bytes, aligned
+ * for O_DIRECT, and its length in @len. It is a quarter of the file, from
+ * BUFMIN to BUFMAX in powers of two, or the whole of a smaller file; free(3)
+ * it when done.
+ */
+static char *
+c_buf (off_t size, size_t *len)
+{
+    void *p = NULL;
+    size_t n = BUFMIN;
+
+    if (size < BUFMIN)
+        n = (size + DIO_ALIGN) & ~(off_t) (DIO_ALIGN - 1);
+    while (n < BUFMAX && (off_t) n < size / 4)
+        n <<= 1;
+    if (posix_memalign (&p, DIO_ALIGN, n))
+        return NULL;
+    *len = n;
+
+    return p;
+}
+
+
+/*
+ * c_mark: journal that the file is copied up to pg->pos, once the copy is
+ * on disk that far, so that a run that stops is taken up from there.
+ */
+static void
+c_mark (progress *pg)
+{
+    st_sys (1);
+    if (fdatasync (pg->dst) < 0)
+        return;
+    job_mark (pg->job, pg->sb, pg->pos);
+    pg->mark = pg->pos;
+}
+
+
+/*
+ * copied: account @n more bytes of the file copied, once per chunk, for the
+ * reporter of stats.c. What was copied is dropped from the page cache every
+ * DROPSZ bytes, and journaled every CKPT_SZ bytes.
+ */
+static void
+copied (progress *pg, off_t n)
+{
+    pg->done += n;
+    pg->pos += n;
+    st_add (ST_BYTES, n);
+    if (pg->pos - pg->wb >= DROPSZ)
+        c_drop (pg, pg->pos);
+    if (pg->job != NULL && pg->pos - pg->mark >= CKPT_SZ)
+        c_mark (pg);
+}
+
+
+/*
+ * copy_reflink: share the data extents of src with dst, supported by btrfs,
+ * XFS and the like when both files are on the same file system.
+ */
+static int
+copy_reflink (int dst, int src, progress *pg)
+{
+#ifdef FICLONE
+    st_sys (1);
+    if (!ioctl (dst, FICLONE, src))
+    {
+        copied (pg, pg->size - pg->done);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+
+/*
+ * copy_seg: copy @len bytes at offset @off of src to the same offset of dst,
+ * within the kernel when it can, through a buffer otherwise.
+ */
+static int
+copy_seg (int dst, int src, off_t off, off_t len, progress *pg)
+{
+    ssize_t n = 0;
+    size_t bl = 0;
+    char *buf = NULL;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    loff_t so = off, dof = off;
+
+    pg->pos = off;
+    while (len > 0 && (n = copy_file_range (src, &so, dst, &dof,
+                                            len > COPYSZ ? COPYSZ : len, 0)) > 0)
+    {
+        st_sys (1);
+        copied (pg, n);
+        len -= n;
+    }
+    if (len > 0)
+        st_sys (1);     /* the call that stopped the loop */
+    if (n < 0 && errno != EXDEV && errno != EINVAL && errno != ENOSYS
+        && errno != EOPNOTSUPP && errno != EBADF)
+        return -1;
+    off = so;
+#endif
+    if (len <= 0)
+        return 1;
+    pg->pos = off;
+    if ((buf = c_buf (len, &bl)) == NULL)
+        return -1;
+    while (len > 0 && (n = pread (src, buf, len > (off_t) bl ? (off_t) bl
+                                                              : len, off)) > 0)
+    {
+        if (pwrite (dst, buf, n, off) != n)
+        {
+            n = -1;
+            break;
+        }
+        st_sys (2);
+        copied (pg, n);
+        off += n;
+        len -= n;
+    }
+    free (buf);
+
+    return n < 0 ? -1 : 1;
+}
+
+
+/*
+ * copy_sparse: copy only the data extents of a sparse file, found with
+ * lseek(2) SEEK_DATA and SEEK_HOLE, and leave holes in dst where src has
+ * them. The destination is new or truncated, so the holes need not be
+ * punched; ftruncate(2) sets the size past a trailing hole. Files without
+ * holes are left to the faster engines below. A copy taken up from pg->pos
+ * starts there.
+ */
+static int
+copy_sparse (int dst, int src, progress *pg)
+{
+#ifdef SEEK_DATA
+    off_t data = 0, hole = pg->pos, size = 0;
+    struct stat sb;
+
+    if (fstat (src, &sb) < 0 || sb.st_blocks * 512 >= sb.st_size)
+        return 0;
+    size = sb.st_size;
+
+    c_prep (pg, 0);         /* allocating would fill the holes */
+    while (hole < size)
+    {
+        if ((data = lseek (src, hole, SEEK_DATA)) < 0)
+        {
+            if (errno == ENXIO)
+                break;      /* a hole up to the end */
+            return hole ? -1 : 0;
+        }
+        if ((hole = lseek (src, data, SEEK_HOLE)) < 0)
+            return -1;
+        st_sys (2);
+        if (hole > size)
+            hole = size;    /* file grew meanwhile */
+        if (copy_seg (dst, src, data, hole - data, pg) < 0)
+            return -1;
+    }
+    if (ftruncate (dst, size) < 0)
+        return -1;
+    pg->pos = size;         /* the holes are not counted as copied */
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * copy_range: copy data within the kernel with copy_file_range(2).
+ */
+static int
+copy_range (int dst, int src, progress *pg)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    ssize_t n = 0;
+    short first = 1;
+
+    c_prep (pg, 1);
+    while ((n = copy_file_range (src, NULL, dst, NULL, COPYSZ, 0)) > 0)
+    {
+        st_sys (1);
+        copied (pg, n);
+        first = 0;
+    }
+    st_sys (1);
+    if (!n)
+        return 1;
+    if (first && (errno == EXDEV || errno == EINVAL || errno == ENOSYS
+        || errno == EOPNOTSUPP || errno == EBADF))
+        return 0;
+
+    return -1;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * copy_sendfile: copy data within the kernel with sendfile(2).
+ */
+static int
+copy_sendfile (int dst, int src, progress *pg)
+{
+#ifdef HAVE_SENDFILE
+    ssize_t n = 0;
+    short first = 1;
+
+    c_prep (pg, 1);
+    while ((n = sendfile (dst, src, NULL, COPYSZ)) > 0)
+    {
+        st_sys (1);
+        copied (pg, n);
+        first = 0;
+    }
+    st_sys (1);
+    if (!n)
+        return 1;
+    if (first && (errno == EINVAL || errno == ENOSYS))
+        return 0;
+
+    return -1;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * copy_direct: with --direct, copy files of BUFMIN bytes or more with
+ * O_DIRECT, past the page cache. The buffer and offsets are aligned to
+ * DIO_ALIGN; a tail shorter than that, at the end of the file, is written
+ * through the cache. File systems without O_DIRECT are left to the next
+ * engines.
+ */
+static int
+copy_direct (int dst, int src, progress *pg)
+{
+    int sfl = 0, dfl = 0, ret = -1;
+    size_t len = 0;
+    ssize_t n = 0, w = 0;
+    off_t from = pg->pos, off = from;
+    char *buf = NULL;
+
+    if (!cdirect || pg->size < BUFMIN
+        || (sfl = fcntl (src, F_GETFL)) < 0 || (dfl = fcntl (dst, F_GETFL)) < 0
+        || fcntl (src, F_SETFL, sfl | O_DIRECT) < 0)
+        return 0;
+    st_sys (4);
+    if (fcntl (dst, F_SETFL, dfl | O_DIRECT) < 0)
+    {
+        fcntl (src, F_SETFL, sfl);
+        return 0;
+    }
+    if ((buf = c_buf (pg->size, &len)) == NULL)
+        goto out;
+
+    c_prep (pg, 1);
+    while ((n = pread (src, buf, len, off)) > 0)
+    {
+        w = n & ~(ssize_t) (DIO_ALIGN - 1);
+        if (w && pwrite (dst, buf, w, off) != w)
+            break;
+        if (w < n && (fcntl (dst, F_SETFL, dfl) < 0
+                      || pwrite (dst, buf + w, n - w, off + w) != n - w))
+            break;
+        st_sys (2);
+        copied (pg, n);
+        off += n;
+    }
+    if (!n)
+        ret = 1;
+    else if (off == from && errno == EINVAL)
+        ret = 0;    /* O_DIRECT is refused at the first read or write */
+
+out:
+    fcntl (src, F_SETFL, sfl);
+    fcntl (dst, F_SETFL, dfl);
+    free (buf);
+
+    return ret;
+}
+
+
+/*
+ * copy_rw: copy data through a user space buffer, works everywhere. The
+ * buffer grows with the size of the file, see c_buf.
+ */
+static int
+copy_rw (int dst, int src, progress *pg)
+{
+    size_t blk = 0;
+    ssize_t rcnt = 0;
+    char *buff = NULL;
+
+    if ((buff = c_buf (pg->size, &blk)) == NULL)
+        return -1;
+
+    c_prep (pg, 1);
+    while ((rcnt = read (src, buff, blk)) > 0)
+    {
+        if (write (dst, buff, rcnt) != rcnt)
+            break;
+        st_sys (2);
+        copied (pg, rcnt);
+    }
+    free (buff);
+
+    return rcnt ? -1 : 1;
+}
+
+
+static engine engines[] = \
+{
+    { "reflink",         copy_reflink },
+    { "sparse",          copy_sparse },
+    { "direct",          copy_direct },
+    { "copy_file_range", copy_range },
+    { "sendfile",        copy_sendfile },
+    { "read/write",      copy_rw },
+    { NULL, NULL }
+};
+
+
+/*
+ * copy_file: copy source file to destination file. Engines are tried in the
+ * order of the engines[] table, the first one that supports the pair of
+ * files does the job. What is left of a large file in the page cache is
+ * dropped when it is done. Copies of large files in a journaled move are
+ * marked in the journal as they go, see jobs.c.
+ *
+ * ctx: context of the move operation.
+ * dst: file descriptor of destination file.
+ * src: file descriptor of source file.
+ * off: offset to take up a copy from, as journaled by a run that stopped,
+ * or 0. A copy shorter than that is done afresh.
+ * eng: set to the name of the engine that copied the file.
+ */
+int
+copy_file (mctx *ctx, int dst, int src, off_t off, const char **eng)
+{
+    int i = 0, ret = 0;
+    struct stat stat_buf, dsb;
+    progress pg = { 0, 0, 0, src, dst, 0, 0, 0, NULL, &stat_buf, 0 };
+
+    assert (ctx != NULL && (src >= 0) && (dst >= 0));
+
+    if (!fstat (src, &stat_buf))
+        pg.size = stat_buf.st_size;
+    if (off > 0 && (fstat (dst, &dsb) < 0 || dsb.st_size < off
+                    || lseek (src, off, SEEK_SET) != off
+                    || lseek (dst, off, SEEK_SET) != off))
+    {
+        lseek (src, 0, SEEK_SET);
+        lseek (dst, 0, SEEK_SET);
+        off = 0;
+        if (ftruncate (dst, 0) < 0)
+            return -1;
+    }
+    pg.done = pg.pos = pg.wb = pg.dropped = pg.mark = off;
+    if (ctx->job != NULL && pg.size >= CKPT_SZ)
+        pg.job = ctx->job;
+    for (i = 0; engines[i].name != NULL; i++)
+    {
+        if ((ret = engines[i].copy (dst, src, &pg)) != 0)
+            break;
+    }
+    if (eng != NULL)
+        *eng = engines[i].name;
+    /* holes, and what a stopped run copied, are not left to copy */
+    if (ret > 0)
+        st_add (ST_SEEN, pg.done - off - pg.size);
+    if (ret > 0 && pg.prep)
+    {    /* the last window is left to writeback, without waiting for it */
+        c_drop (&pg, pg.size);
+#ifdef HAVE_POSIX_FADVISE
+        posix_fadvise (src, 0, 0, POSIX_FADV_DONTNEED);
+        posix_fadvise (dst, pg.dropped, 0, POSIX_FADV_DONTNEED);
+        st_sys (2);
+#endif
+    }
+
+    return ret;
+}
@@ -0,0 +1,473 @@
+/*
+ * daemon.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * ptrashd, the resident trash server. It sets up the home trash, the mount
+ * table, the trashes of the mounts and their catalogs once, and then waits
+ * on $XDG_RUNTIME_DIR/ptrashd.sock. The ptrash command sends its arguments,
+ * environment and umask there, along with its standard streams and working
+ * directory as descriptors. The server forks a child per request, which
+ * takes over those and runs the request as ptrash would have, starting from
+ * the state set up by the server. Its exit status is sent back to ptrash.
+ * When no server is running, or it serves another data directory, ptrash
+ * does the work itself.
+ *
+ * The server executes itself again to start afresh when the mount table
+ * changes, so that the trashes of new mounts are known, and on SIGHUP. A
+ * child that finds the home trash gone or replaced declines its request
+ * and sends SIGHUP to the server.
+ */
+
+#include <ptrash.h>
+#include <ptrashdb.h>
+#include <limits.h>         /* for PATH_MAX */
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/file.h>       /* for flock */
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define D_SOCKET        "ptrashd.sock"
+#define D_MAGIC         0x31445450      /* "PTD1" */
+#define D_MAXLEN        (64 * 1024 * 1024)
+#define D_DECLINE       INT32_MIN       /* run the request in ptrash */
+#define D_NFD           4               /* stdin, stdout, stderr and cwd */
+#define D_FDENV         "PTRASHD_FD"    /* socket kept through execve(2) */
+
+extern char **environ;
+
+/* a request, followed by its arguments and environment strings */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t mask;          /* umask of the client */
+    uint64_t len;           /* bytes of strings */
+} dreq;
+
+static volatile sig_atomic_t dstop = 0;
+static pid_t dpid = 0;      /* child running a request */
+
+
+/*
+ * d_socket: returns the path of the server socket, or NULL when
+ * $XDG_RUNTIME_DIR is not set.
+ */
+static char *
+d_socket (void)
+{
+    char *r = getenv ("XDG_RUNTIME_DIR");
+
+    if (r == NULL || *r != '/')
+        return NULL;
+
+    return build_path (r, D_SOCKET);
+}
+
+
+/* d_addr: fill @sa with the address of socket @path, returns -1 if long */
+static int
+d_addr (struct sockaddr_un *sa, const char *path)
+{
+    memset (sa, 0, sizeof (*sa));
+    sa->sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof (sa->sun_path))
+        return -1;
+    strcpy (sa->sun_path, path);
+
+    return 0;
+}
+
+
+/* d_write: write all of @len bytes of @buf to socket @s */
+static int
+d_write (int s, const void *buf, size_t len)
+{
+    ssize_t n = 0;
+
+    while (len > 0)
+    {
+        if ((n = send (s, buf, len, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf = (const char *) buf + n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+/* d_read: read all of @len bytes from socket @s into @buf */
+static int
+d_read (int s, void *buf, size_t len)
+{
+    ssize_t n = 0;
+
+    while (len > 0)
+    {
+        if ((n = recv (s, buf, len, 0)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf = (char *) buf + n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+/*
+ * d_client: hand the command line over to ptrashd. Returns 0 when the
+ * server has run it, with its exit status in @status, and -1 when there is
+ * no server to run it, or it declined; ptrash then runs it itself.
+ */
+int
+d_client (int argc, char *argv[], int *status)
+{
+    int i = 0, s = -1, cwd = -1, fds[D_NFD];
+    int32_t st = 0;
+    size_t l = 0;
+    char *path = NULL, *buf = NULL, *p = NULL;
+    char cbuf[CMSG_SPACE (sizeof (fds))];
+    dreq rq = { D_MAGIC, argc, 0, 0, 0 };
+    struct sockaddr_un sa;
+    struct iovec iov = { &rq, sizeof (rq) };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cm = NULL;
+
+    assert (argv != NULL && status != NULL);
+
+    if ((path = d_socket ()) == NULL || d_addr (&sa, path) < 0)
+    {
+        free (path);
+        return -1;
+    }
+    free (path);
+    for (i = 0; i < 3; i++)
+        if (fcntl (i, F_GETFD) < 0)
+            return -1;      /* a stream is closed, nothing to pass */
+    if ((s = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (connect (s, (struct sockaddr *) &sa, sizeof (sa)) < 0
+        || (cwd = open (".", O_PATH|O_DIRECTORY|O_CLOEXEC)) < 0)
+        goto err;
+
+    for (i = 0; i < argc; i++)
+        rq.len += strlen (argv[i]) + 1;
+    for (rq.envc = 0; environ[rq.envc] != NULL; rq.envc++)
+        rq.len += strlen (environ[rq.envc]) + 1;
+    if (rq.len > D_MAXLEN || (p = buf = malloc (rq.len)) == NULL)
+        goto err;
+    for (i = 0; i < argc; i++, p += l)
+        memcpy (p, argv[i], l = strlen (argv[i]) + 1);
+    for (i = 0; environ[i] != NULL; i++, p += l)
+        memcpy (p, environ[i], l = strlen (environ[i]) + 1);
+    rq.mask = umask (0);
+    umask (rq.mask);
+
+    fds[0] = 0;
+    fds[1] = 1;
+    fds[2] = 2;
+    fds[3] = cwd;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof (cbuf);
+    cm = CMSG_FIRSTHDR (&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN (sizeof (fds));
+    memcpy (CMSG_DATA (cm), fds, sizeof (fds));
+
+    fflush (NULL);
+    if (sendmsg (s, &msg, MSG_NOSIGNAL) != sizeof (rq)
+        || d_write (s, buf, rq.len) < 0)
+        goto err;
+    free (buf);
+    close (cwd);
+
+    if (d_read (s, &st, sizeof (st)) < 0)
+    {    /* the request may have been run in part, it is not run again */
+        warnx ("ptrashd did not complete the request");
+        st = -1;
+    }
+    close (s);
+    if (st == D_DECLINE)
+        return -1;
+    *status = st;
+
+    return 0;
+
+err:
+    free (buf);
+    if (cwd >= 0)
+        close (cwd);
+    close (s);
+    return -1;
+}
+
+
+/*
+ * d_reply: send the exit status of a request to its client; registered
+ * with on_exit(3) in the child running the request.
+ */
+static void
+d_reply (int status, void *arg)
+{
+    int32_t st = status;
+
+    if (getpid () != dpid)
+        return;     /* a process forked by the request */
+    fflush (NULL);
+    d_write ((intptr_t) arg, &st, sizeof (st));
+}
+
+
+/*
+ * d_request: read the request on connection @c, in the child forked for
+ * it, and take over its streams, working directory, umask and environment.
+ * Returns 0 with the command line of the request in @argc and @argv, or -1
+ * when it is not to be run here.
+ */
+static int
+d_request (int c, int *argc, char ***argv)
+{
+    int i = 0, n = 0, fds[D_NFD];
+    int32_t st = D_DECLINE;
+    char *buf = NULL, *p = NULL, *e = NULL, *dh = getenv ("XDG_DATA_HOME");
+    char **v = NULL, cbuf[CMSG_SPACE (sizeof (fds))];
+    dreq rq;
+    trash *t = NULL;
+    struct stat sb, fsb;
+    struct ucred cr;
+    socklen_t cl = sizeof (cr);
+    struct iovec iov = { &rq, sizeof (rq) };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cm = NULL;
+
+    if (getsockopt (c, SOL_SOCKET, SO_PEERCRED, &cr, &cl) < 0
+        || cr.uid != getuid ())
+        return -1;      /* the trash of another user */
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof (cbuf);
+    if (recvmsg (c, &msg, MSG_CMSG_CLOEXEC) != sizeof (rq)
+        || (cm = CMSG_FIRSTHDR (&msg)) == NULL
+        || cm->cmsg_type != SCM_RIGHTS
+        || cm->cmsg_len != CMSG_LEN (sizeof (fds)))
+        return -1;
+    memcpy (fds, CMSG_DATA (cm), sizeof (fds));
+    if (rq.magic != D_MAGIC || !rq.argc || rq.len > D_MAXLEN
+        || (buf = malloc (rq.len + 1)) == NULL
+        || (v = calloc (rq.argc + rq.envc + 2, sizeof (char *))) == NULL
+        || d_read (c, buf, rq.len) < 0)
+        return -1;
+
+    buf[rq.len] = '\0';
+    for (p = buf, e = buf + rq.len; p < e; p += strlen (p) + 1)
+    {
+        if (n == (int) (rq.argc + rq.envc))
+            return -1;
+        v[n < (int) rq.argc ? n : n + 1] = p;   /* NULL after the args */
+        n++;
+    }
+    if (n != (int) (rq.argc + rq.envc))
+        return -1;
+
+    /* the state set up here is that of the server's data directory */
+    for (i = rq.argc + 1, p = NULL; v[i] != NULL; i++)
+        if (!strncmp (v[i], "XDG_DATA_HOME=", 14))
+            p = v[i] + 14;
+    if ((p == NULL) != (dh == NULL) || (p != NULL && strcmp (p, dh)))
+    {
+        d_write (c, &st, sizeof (st));
+        return -1;
+    }
+    if ((t = trash_get (0)) == NULL || stat (t->files, &sb) < 0
+        || fstat (t->fd, &fsb) < 0 || sb.st_ino != fsb.st_ino
+        || sb.st_dev != fsb.st_dev)
+    {    /* the home trash was removed, the server starts afresh */
+        d_write (c, &st, sizeof (st));
+        kill (getppid (), SIGHUP);
+        return -1;
+    }
+
+    for (i = 0; i < 3; i++)
+        if (dup2 (fds[i], i) < 0)
+            return -1;
+    if (fchdir (fds[3]) < 0)
+        return -1;
+    for (i = 0; i < D_NFD; i++)
+        close (fds[i]);
+    umask (rq.mask);
+    environ = v + rq.argc + 1;
+    dpid = getpid ();
+    on_exit (d_reply, (void *) (intptr_t) c);
+
+    *argc = rq.argc;
+    *argv = v;
+    return 0;
+}
+
+
+static void
+d_signal (int sig)
+{
+    dstop = sig;
+}
+
+
+/*
+ * d_serve: run as ptrashd, the server of the ptrash requests sent to
+ * $XDG_RUNTIME_DIR/ptrashd.sock. It returns only in the children forked
+ * for the requests: 0 with the command line of the request in @argc and
+ * @argv, ready to be run by main. Returns -1 if the server can not start.
+ */
+int
+d_serve (int *argc, char ***argv)
+{
+    int i = 0, s = -1, c = -1, lk = -1, mfd = -1;
+    char *path = NULL, *lock = NULL;
+    pid_t pid = 0;
+    mode_t m = 0;
+    trash *t = NULL;
+    struct sockaddr_un sa;
+    struct pollfd pf[2];
+    struct sigaction sg;
+
+    assert (argc != NULL && argv != NULL);
+
+    if ((path = d_socket ()) == NULL)
+    {
+        warnx ("XDG_RUNTIME_DIR is not set, ptrashd has no socket");
+        return -1;
+    }
+    if (d_addr (&sa, path) < 0)
+    {
+        warnx ("socket path `%s' is too long", path);
+        return -1;
+    }
+    if ((lock = malloc (strlen (path) + 6)) == NULL)
+        err (-1, "could not allocate memory");
+    sprintf (lock, "%s.lock", path);
+    if ((lk = open (lock, O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR)) < 0
+        || flock (lk, LOCK_EX|LOCK_NB) < 0)
+    {
+        warn ("ptrashd is running already, could not lock `%s'", lock);
+        return -1;
+    }
+    free (lock);
+
+    /* the state the requests start from */
+    if (init_move () == -1)
+        return -1;
+    trash_scan ();
+    for (i = 0; (t = trash_get (i)) != NULL; i++)
+        use_trash (t);
+    use_trash (trash_get (0));
+    iob_put ();         /* a ring is not shared with the children */
+
+    if ((lock = getenv (D_FDENV)) != NULL)
+    {    /* executed again, connections waiting on the socket are kept */
+        s = atoi (lock);
+        fcntl (s, F_SETFD, FD_CLOEXEC);
+        unsetenv (D_FDENV);
+    }
+    else
+    {
+        m = umask (S_IRWXG|S_IRWXO);
+        unlink (path);
+        if ((s = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0
+            || bind (s, (struct sockaddr *) &sa, sizeof (sa)) < 0
+            || listen (s, SOMAXCONN) < 0)
+        {
+            warn ("could not listen on socket `%s'", path);
+            return -1;
+        }
+        umask (m);
+    }
+    mfd = open ("/proc/self/mountinfo", O_RDONLY|O_CLOEXEC);
+
+    memset (&sg, 0, sizeof (sg));
+    sg.sa_handler = SIG_IGN;
+    sigaction (SIGCHLD, &sg, NULL);     /* children are not waited for */
+    sg.sa_handler = d_signal;
+    sigaction (SIGTERM, &sg, NULL);
+    sigaction (SIGINT, &sg, NULL);
+    sigaction (SIGHUP, &sg, NULL);
+
+    pf[0].fd = s;
+    pf[0].events = POLLIN;
+    pf[1].fd = mfd;
+    pf[1].events = POLLPRI;
+    while (!dstop || dstop == SIGHUP)
+    {
+        if (poll (pf, mfd >= 0 ? 2 : 1, -1) < 0 && dstop != SIGHUP)
+            continue;
+        if (dstop == SIGHUP
+            || (mfd >= 0 && (pf[1].revents & (POLLPRI|POLLERR))))
+        {    /* a file system came or went, start afresh */
+            char fd[16], exe[PATH_MAX + 1];
+            ssize_t n = readlink ("/proc/self/exe", exe, PATH_MAX);
+
+            snprintf (fd, sizeof (fd), "%d", s);
+            setenv (D_FDENV, fd, 1);
+            fcntl (s, F_SETFD, 0);
+            exe[n > 0 ? n : 0] = '\0';
+            execv (n > 0 ? exe : "/proc/self/exe", *argv);
+            err (-1, "could not execute ptrashd again");
+        }
+        if (!(pf[0].revents & POLLIN)
+            || (c = accept4 (s, NULL, NULL, SOCK_CLOEXEC)) < 0)
+            continue;
+
+        fflush (NULL);
+        if ((pid = fork ()) < 0)
+            warn ("could not fork a child for a request");
+        else if (!pid)
+        {
+            close (s);
+            close (lk);
+            if (mfd >= 0)
+                close (mfd);
+            sg.sa_handler = SIG_DFL;
+            sigaction (SIGCHLD, &sg, NULL);
+            sigaction (SIGTERM, &sg, NULL);
+            sigaction (SIGINT, &sg, NULL);
+            sigaction (SIGHUP, &sg, NULL);
+            t_detach ();
+            if (d_request (c, argc, argv) < 0)
+                _exit (-1);
+            free (path);
+            return 0;
+        }
+        close (c);
+    }
+
+    unlink (path);
+    exit (0);
+}
@@ -0,0 +1,249 @@
+/*
+ * dents.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Directory reading with getdents64(2) into a buffer of the caller's size.
+ * readdir(3) fetches 32 KiB of entries per system call; a large directory
+ * is read with far fewer calls through a bigger buffer.
+ *
+ * For --schedule, dents_sort reads a directory whole and hands its entries
+ * out in the order of their inodes, or of their data on disk, instead of
+ * that of the directory, to cut the seeks of a spinning disk.
+ */
+
+#include <ptrash.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fiemap.h>   /* for struct fiemap */
+
+/* an entry of a sorted directory */
+typedef struct
+{
+    short cls;              /* 0 for data placed on disk, 1 for the rest */
+    uint64_t key;           /* physical offset of the data, or inode */
+    struct dirent64 *de;
+} dkey;
+
+struct dents
+{
+    int fd;
+    size_t size;            /* size of buf */
+    long len;               /* bytes of entries in buf */
+    long pos;               /* next entry in buf */
+    dkey *ord;              /* entries in sorted order, or NULL */
+    size_t nord, iord;      /* their number, and the next one */
+    char buf[];
+};
+
+
+/*
+ * dents_open: start reading the directory @fd with a buffer of @size bytes.
+ * The descriptor stays owned by the caller. Returns NULL on error.
+ */
+dents *
+dents_open (int fd, size_t size)
+{
+    dents *d = NULL;
+
+    assert (fd >= 0 && size >= sizeof (struct dirent64) + NAME_MAX);
+
+    if ((d = malloc (sizeof (dents) + size)) == NULL)
+        return NULL;
+    d->fd = fd;
+    d->size = size;
+    d->len = d->pos = 0;
+    d->ord = NULL;
+
+    return d;
+}
+
+
+/*
+ * dents_init: start reading the directory @fd into @size bytes of memory at
+ * @mem, provided by the caller and suitably aligned. It is not released
+ * with dents_close.
+ */
+dents *
+dents_init (int fd, void *mem, size_t size)
+{
+    dents *d = mem;
+
+    assert (fd >= 0 && mem != NULL
+            && size >= sizeof (dents) + sizeof (struct dirent64) + NAME_MAX);
+
+    d->fd = fd;
+    d->size = size - sizeof (dents);
+    d->len = d->pos = 0;
+    d->ord = NULL;
+
+    return d;
+}
+
+
+/*
+ * dents_read: returns the next entry of the directory, skipping `.' and
+ * `..', or NULL at the end or on error, with errno set.
+ */
+struct dirent64 *
+dents_read (dents *d)
+{
+    struct dirent64 *e = NULL;
+
+    assert (d != NULL);
+
+    if (d->ord != NULL)
+        return d->iord < d->nord ? d->ord[d->iord++].de : NULL;
+    for (;;)
+    {
+        if (d->pos >= d->len)
+        {
+            st_begin (PH_READDIR);
+            st_sys (1);
+            errno = 0;
+            d->len = syscall (SYS_getdents64, d->fd, d->buf, d->size);
+            st_end ();
+            d->pos = 0;
+            if (d->len <= 0)
+                return NULL;
+        }
+
+        e = (struct dirent64 *)(d->buf + d->pos);
+        d->pos += e->d_reclen;
+        if (e->d_name[0] == '.' && (!e->d_name[1]
+            || (e->d_name[1] == '.' && !e->d_name[2])))
+            continue;
+
+        return e;
+    }
+}
+
+
+/*
+ * d_extent: find in @pos the physical offset of the first extent of the
+ * data of the regular file @name, with FS_IOC_FIEMAP. Returns 1 if it was
+ * found, 0 if the file has no data placed on disk yet, and -1 if the file
+ * system does not map extents.
+ */
+static int
+d_extent (int dfd, const char *name, uint64_t *pos)
+{
+    int fd = -1, ret = 0;
+    struct
+    {
+        struct fiemap fm;
+        struct fiemap_extent fe;
+    } m;
+
+    if ((fd = openat (dfd, name, O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_CLOEXEC))
+        < 0)
+        return 0;
+    memset (&m, 0, sizeof (m));
+    m.fm.fm_length = FIEMAP_MAX_OFFSET;
+    m.fm.fm_extent_count = 1;
+    if (ioctl (fd, FS_IOC_FIEMAP, &m.fm) < 0)
+        ret = errno == EOPNOTSUPP || errno == ENOTTY ? -1 : 0;
+    else if (m.fm.fm_mapped_extents
+             && !(m.fe.fe_flags & (FIEMAP_EXTENT_UNKNOWN
+                                   | FIEMAP_EXTENT_DATA_INLINE)))
+    {
+        *pos = m.fe.fe_physical;
+        ret = 1;
+    }
+    close (fd);
+
+    return ret;
+}
+
+
+static int
+d_cmp (const void *a, const void *b)
+{
+    const dkey *x = a, *y = b;
+
+    if (x->cls != y->cls)
+        return x->cls - y->cls;
+
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+
+/*
+ * dents_sort: read the rest of the directory, for dents_read to return its
+ * entries sorted as @how says: SCHED_INODE by inode number, SCHED_EXTENT
+ * regular files by the place of their data on disk, before the rest by
+ * inode number. Entries are kept in the arena of the calling thread. Returns
+ * the number of entries.
+ */
+size_t
+dents_sort (dents *d, short how)
+{
+    size_t cap = 0;
+    dkey *k = NULL, *nk = NULL;
+    struct dirent64 *e = NULL;
+
+    assert (d != NULL && d->ord == NULL);
+
+    d->nord = d->iord = 0;
+    while ((e = dents_read (d)) != NULL)
+    {
+        if (d->nord == cap)
+        {    /* the old array is left to the arena */
+            nk = arena_alloc ((cap = cap ? cap * 2 : 256) * sizeof (dkey));
+            if (k != NULL)
+                memcpy (nk, k, d->nord * sizeof (dkey));
+            k = nk;
+        }
+        nk = &k[d->nord++];
+        nk->de = memcpy (arena_alloc (e->d_reclen), e, e->d_reclen);
+        nk->cls = 1;
+        nk->key = e->d_ino;
+        if (how != SCHED_EXTENT || e->d_type != DT_REG)
+            continue;
+        switch (d_extent (d->fd, e->d_name, &nk->key))
+        {
+        case 1:
+            nk->cls = 0;
+            break;
+
+        case 0:
+            nk->key = e->d_ino;
+            break;
+
+        default:
+            how = SCHED_INODE;  /* no extents on this file system */
+        }
+    }
+    if (k != NULL)
+        qsort (k, d->nord, sizeof (dkey), d_cmp);
+    d->ord = k;
+
+    return d->nord;
+}
+
+
+/*
+ * dents_close: release the buffer, the directory is not closed.
+ */
+void
+dents_close (dents *d)
+{
+    free (d);
+}
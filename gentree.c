@@ -0,0 +1,232 @@
+/*
+ * gentree.c -- move unwanted files to trash; This file is part of the
+ * program 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * gentree: make the trees timed by `make bench', see bench.sh. The names,
+ * sizes and contents of the files come from a seeded xorshift generator,
+ * so that a tree is the same on every run. It prints the number of files
+ * and of bytes of data made.
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PER_DIR         1000            /* tiny files per directory */
+#define DEEP_FILES      4               /* files at each level of deep */
+#define SPARSE_DATA     (1 << 20)       /* data extent of a sparse file */
+#define SPARSE_STEP     (64LL << 20)    /* and its distance to the next */
+#define BUFSZ           (1 << 20)
+
+static uint64_t seed = 1;
+static long long nfiles = 0, nbytes = 0;
+static char *buf = NULL;
+
+
+static uint64_t
+next (uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+
+    return *s;
+}
+
+
+static void
+usage (void)
+{
+    fprintf (stderr, "Usage: gentree [-s SEED] KIND DIR N [SIZE]\n");
+    fprintf (stderr, "\tKIND is one of:\n");
+    fprintf (stderr, "\ttiny    N files of up to SIZE bytes, 4096 by default\n");
+    fprintf (stderr, "\tdeep    N levels of directories, with %d files at"
+             " each\n", DEEP_FILES);
+    fprintf (stderr, "\thuge    N files of SIZE bytes\n");
+    fprintf (stderr, "\tsparse  N files of SIZE bytes, %d MiB of data every"
+             " %lld MiB\n", SPARSE_DATA >> 20, SPARSE_STEP >> 20);
+    fprintf (stderr, "\tfifo    N named pipes\n");
+    exit (-1);
+}
+
+
+/*
+ * mkfile: make the file @name in @dfd of @size bytes. With @step set, it
+ * has @len bytes of data every @step bytes and holes in between; else its
+ * data is all of it. The data is that of the generator seeded with @id.
+ */
+static void
+mkfile (int dfd, const char *name, long long id, off_t size, off_t len,
+        off_t step)
+{
+    int fd = -1;
+    size_t i = 0, n = 0;
+    off_t off = 0, ext = 0, l = 0;
+    uint64_t s = (seed + id) * 0x9e3779b97f4a7c15ULL | 1;
+
+    if ((fd = openat (dfd, name, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0)
+        err (-1, "could not create file `%s'", name);
+    for (ext = 0; ext < size; ext += step ? step : size)
+    {
+        off = ext;
+        l = step ? len : size;
+        if (l > size - ext)
+            l = size - ext;
+        while (l > 0)
+        {
+            n = l > BUFSZ ? BUFSZ : l;
+            for (i = 0; i + 8 <= n; i += 8)
+            {
+                uint64_t v = next (&s);
+
+                memcpy (buf + i, &v, 8);
+            }
+            if (pwrite (fd, buf, n, off) != (ssize_t) n)
+                err (-1, "could not write file `%s'", name);
+            nbytes += n;
+            off += n;
+            l -= n;
+        }
+    }
+    if (ftruncate (fd, size) < 0)
+        err (-1, "could not size file `%s'", name);
+    close (fd);
+    nfiles++;
+}
+
+
+/* mkdirfd: make the directory @name in @dfd and return its descriptor */
+static int
+mkdirfd (int dfd, const char *name)
+{
+    int fd = -1;
+
+    if (mkdirat (dfd, name, 0755) < 0 && errno != EEXIST)
+        err (-1, "could not create directory `%s'", name);
+    if ((fd = openat (dfd, name, O_RDONLY|O_DIRECTORY)) < 0)
+        err (-1, "could not open directory `%s'", name);
+
+    return fd;
+}
+
+
+int
+main (int argc, char *argv[])
+{
+    int c = 0, top = -1, dfd = -1, nfd = -1;
+    long long i = 0, n = 0, size = 0;
+    char name[64];
+    const char *kind = NULL;
+    uint64_t s = 0;
+
+    while ((c = getopt (argc, argv, "s:")) != -1)
+    {
+        if (c != 's')
+            usage ();
+        seed = strtoull (optarg, NULL, 0);
+    }
+    if (argc - optind < 3)
+        usage ();
+    kind = argv[optind];
+    n = atoll (argv[optind + 2]);
+    size = argc - optind > 3 ? atoll (argv[optind + 3]) : 0;
+    if ((buf = malloc (BUFSZ)) == NULL)
+        err (-1, "could not allocate memory");
+    top = mkdirfd (AT_FDCWD, argv[optind + 1]);
+    s = seed | 1;
+
+    if (!strcmp (kind, "tiny"))
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (!(i % PER_DIR))
+            {
+                if (dfd >= 0)
+                    close (dfd);
+                snprintf (name, sizeof (name), "d%06lld", i / PER_DIR);
+                dfd = mkdirfd (top, name);
+            }
+            snprintf (name, sizeof (name), "f%08llx", (long long)
+                      (next (&s) & 0xffffffffLL));
+            c = next (&s) % ((size ? size : 4096) + 1);
+            mkfile (dfd, name, i, c, 0, 0);
+        }
+    }
+    else if (!strcmp (kind, "deep"))
+    {
+        for (dfd = dup (top), i = 0; i < n; i++)
+        {
+            for (c = 0; c < DEEP_FILES; c++)
+            {
+                snprintf (name, sizeof (name), "f%d", c);
+                mkfile (dfd, name, i * DEEP_FILES + c, 512, 0, 0);
+            }
+            nfd = mkdirfd (dfd, "d");
+            close (dfd);
+            dfd = nfd;
+        }
+    }
+    else if (!strcmp (kind, "huge"))
+    {
+        for (i = 0; i < n; i++)
+        {
+            snprintf (name, sizeof (name), "huge%lld", i);
+            mkfile (top, name, i, size, 0, 0);
+        }
+    }
+    else if (!strcmp (kind, "sparse"))
+    {
+        for (i = 0; i < n; i++)
+        {
+            snprintf (name, sizeof (name), "sparse%lld", i);
+            mkfile (top, name, i, size, SPARSE_DATA, SPARSE_STEP);
+        }
+    }
+    else if (!strcmp (kind, "fifo"))
+    {
+        for (i = 0; i < n; i++)
+        {
+            snprintf (name, sizeof (name), "p%lld", i);
+            if (mkfifoat (top, name, 0644) < 0 && errno != EEXIST)
+                err (-1, "could not create fifo `%s'", name);
+            nfiles++;
+        }
+    }
+    else
+        usage ();
+
+    if (dfd >= 0)
+        close (dfd);
+    close (top);
+    free (buf);
+    printf ("%lld %lld\n", nfiles, nbytes);
+
+    return 0;
+}
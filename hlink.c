@@ -0,0 +1,162 @@
+/*
+ * hlink.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Hard links of the files copied to trash. The first link of a file met in
+ * a traversal is copied, and the path of its copy is kept here by the
+ * (st_dev, st_ino) of the source. The other links are then made with
+ * linkat(2) to that copy. An entry goes once all the links of the file are
+ * met, the table holds those seen part way only.
+ */
+
+#include <ptrash.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* the copy of a file with several links */
+typedef struct hlink
+{
+    dev_t dev;
+    ino_t ino;
+    nlink_t left;           /* links not met yet */
+    char *path;             /* path of the copy in trash */
+    struct hlink *next;
+} hlink;
+
+static hlink **htab = NULL;
+static size_t hsize = 0, hcount = 0;
+static pthread_mutex_t hlock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static size_t
+hl_hash (dev_t dev, ino_t ino)
+{
+    uint64_t h = (uint64_t) ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t) dev;
+
+    return (h ^ (h >> 29)) & (hsize - 1);
+}
+
+
+/* hl_grow: double the number of buckets, called with hlock held */
+static void
+hl_grow (void)
+{
+    size_t i = 0, osize = hsize;
+    hlink **otab = htab, *e = NULL, *n = NULL;
+
+    if ((htab = calloc (osize ? osize * 2 : 256, sizeof (hlink *))) == NULL)
+    {
+        htab = otab;
+        return;
+    }
+    hsize = osize ? osize * 2 : 256;
+    for (i = 0; i < osize; i++)
+        for (e = otab[i]; e != NULL; e = n)
+        {
+            n = e->next;
+            e->next = htab[hl_hash (e->dev, e->ino)];
+            htab[hl_hash (e->dev, e->ino)] = e;
+        }
+    free (otab);
+}
+
+
+/*
+ * hl_add: remember @path, the copy in trash of the file @sb, for its other
+ * links to be made to it.
+ */
+void
+hl_add (const struct stat *sb, const char *path)
+{
+    hlink *e = NULL;
+
+    assert (sb != NULL && path != NULL);
+
+    if ((e = malloc (sizeof (hlink))) == NULL
+        || (e->path = strdup (path)) == NULL)
+    {
+        free (e);
+        return;     /* the other links are copied */
+    }
+    e->dev = sb->st_dev;
+    e->ino = sb->st_ino;
+    e->left = sb->st_nlink - 1;
+
+    pthread_mutex_lock (&hlock);
+    if (hcount >= hsize)
+        hl_grow ();
+    if (hsize)
+    {
+        e->next = htab[hl_hash (e->dev, e->ino)];
+        htab[hl_hash (e->dev, e->ino)] = e;
+        __atomic_add_fetch (&hcount, 1, __ATOMIC_RELEASE);
+        e = NULL;
+    }
+    pthread_mutex_unlock (&hlock);
+
+    if (e != NULL)
+    {
+        free (e->path);
+        free (e);
+    }
+}
+
+
+/*
+ * hl_find: returns the path in trash of the copy of an earlier link of the
+ * file @sb, in the arena of the thread, or NULL if there is none. The entry
+ * is dropped when this is the last link of the file.
+ */
+char *
+hl_find (const struct stat *sb)
+{
+    char *p = NULL;
+    hlink **pe = NULL, *e = NULL;
+
+    assert (sb != NULL);
+
+    if (!__atomic_load_n (&hcount, __ATOMIC_ACQUIRE))
+        return NULL;    /* most trees have no links */
+    pthread_mutex_lock (&hlock);
+    for (pe = hsize ? &htab[hl_hash (sb->st_dev, sb->st_ino)] : NULL;
+         pe != NULL && (e = *pe) != NULL; pe = &e->next)
+        if (e->dev == sb->st_dev && e->ino == sb->st_ino)
+            break;
+    if (e != NULL)
+    {
+        p = arena_strdup (e->path);
+        if (!--e->left)
+        {
+            *pe = e->next;
+            __atomic_sub_fetch (&hcount, 1, __ATOMIC_RELEASE);
+        }
+        else
+            e = NULL;
+    }
+    pthread_mutex_unlock (&hlock);
+
+    if (e != NULL)
+    {
+        free (e->path);
+        free (e);
+    }
+
+    return p;
+}
@@ -0,0 +1,400 @@
+/*
+ * iob.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A batch of file system requests. With io_uring, requests are queued as
+ * submission queue entries and handed to the kernel with one system call
+ * per batch; otherwise, or for requests the kernel does not support, each
+ * one is done right away with a plain system call. Either way, the result
+ * of a request is stored in the int it was queued with: a non-negative
+ * value on success, or -errno on failure.
+ */
+
+#include <ptrash.h>
+#include <sys/sysmacros.h>  /* for makedev */
+
+#ifdef HAVE_IO_URING
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <linux/io_uring.h>
+#endif
+
+struct iobatch
+{
+    int fd;                 /* io_uring descriptor, -1 for plain calls */
+    unsigned queued;        /* entries queued, but not yet submitted */
+#ifdef HAVE_IO_URING
+    unsigned n;
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqring, *cqring;
+    size_t sqsz, cqsz;
+    unsigned char ok[IORING_OP_LAST];   /* operations supported */
+#endif
+};
+
+static __thread iobatch *tb = NULL;
+
+
+#ifdef HAVE_IO_URING
+/*
+ * iob_ring: set up an io_uring of @n entries for the batch. Returns 0 on
+ * success and -1 if io_uring is not available.
+ */
+static int
+iob_ring (iobatch *b, unsigned n)
+{
+    int i = 0;
+    struct io_uring_params p;
+    struct io_uring_probe *pr = NULL;
+    size_t prsz = sizeof (*pr) + IORING_OP_LAST * sizeof (pr->ops[0]);
+
+    memset (&p, 0, sizeof (p));
+    if ((b->fd = syscall (__NR_io_uring_setup, n, &p)) < 0)
+        return -1;
+
+    b->n = p.sq_entries;
+    b->sqsz = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    b->cqsz = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    b->sqring = mmap (NULL, b->sqsz, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, b->fd, IORING_OFF_SQ_RING);
+    b->cqring = mmap (NULL, b->cqsz, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, b->fd, IORING_OFF_CQ_RING);
+    b->sqes = mmap (NULL, p.sq_entries * sizeof (struct io_uring_sqe),
+                    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, b->fd,
+                    IORING_OFF_SQES);
+    if (b->sqring == MAP_FAILED || b->cqring == MAP_FAILED
+        || b->sqes == MAP_FAILED)
+        goto err;
+
+    b->sqhead = b->sqring + p.sq_off.head;
+    b->sqtail = b->sqring + p.sq_off.tail;
+    b->sqmask = b->sqring + p.sq_off.ring_mask;
+    b->sqarray = b->sqring + p.sq_off.array;
+    b->cqhead = b->cqring + p.cq_off.head;
+    b->cqtail = b->cqring + p.cq_off.tail;
+    b->cqmask = b->cqring + p.cq_off.ring_mask;
+    b->cqes = b->cqring + p.cq_off.cqes;
+
+    if ((pr = calloc (1, prsz)) == NULL)
+        goto err;
+    if (!syscall (__NR_io_uring_register, b->fd, IORING_REGISTER_PROBE, pr,
+                  IORING_OP_LAST))
+    {
+        for (i = 0; i < pr->ops_len && i < IORING_OP_LAST; i++)
+            b->ok[i] = !!(pr->ops[i].flags & IO_URING_OP_SUPPORTED);
+    }
+    free (pr);
+
+    return 0;
+
+err:
+    close (b->fd);
+    b->fd = -1;
+    return -1;
+}
+
+
+/*
+ * iob_sqe: returns a cleared submission queue entry for operation @op, or
+ * NULL when the request should be done with a plain system call.
+ */
+static struct io_uring_sqe *
+iob_sqe (iobatch *b, unsigned char op, int flags, int *res)
+{
+    unsigned t = 0;
+    struct io_uring_sqe *sqe = NULL;
+
+    if (b->fd < 0 || !b->ok[op])
+    {
+        iob_submit (b);     /* keep requests in order */
+        return NULL;
+    }
+    if (b->queued == b->n)
+        iob_submit (b);
+
+    t = *b->sqtail;
+    sqe = &b->sqes[t & *b->sqmask];
+    memset (sqe, 0, sizeof (*sqe));
+    sqe->opcode = op;
+    sqe->user_data = (unsigned long) res;
+    if (flags & IOB_LINK)
+        sqe->flags = IOSQE_IO_HARDLINK;
+
+    b->sqarray[t & *b->sqmask] = t & *b->sqmask;
+    __atomic_store_n (b->sqtail, t + 1, __ATOMIC_RELEASE);
+    b->queued++;
+
+    return sqe;
+}
+#endif
+
+
+/*
+ * iob_get: returns the batch of the calling thread, setting it up on first
+ * use. A batch is never shared between threads.
+ */
+iobatch *
+iob_get (void)
+{
+    if (tb != NULL)
+        return tb;
+
+    if ((tb = calloc (1, sizeof (iobatch))) == NULL)
+        err (-1, "could not allocate I/O batch");
+    tb->fd = -1;
+#ifdef HAVE_IO_URING
+    iob_ring (tb, IOB_DEPTH);
+#endif
+
+    return tb;
+}
+
+
+/*
+ * iob_put: release the batch of the calling thread, before it exits.
+ */
+void
+iob_put (void)
+{
+    if (tb == NULL)
+        return;
+
+    iob_submit (tb);
+#ifdef HAVE_IO_URING
+    if (tb->fd >= 0)
+    {
+        munmap (tb->sqring, tb->sqsz);
+        munmap (tb->cqring, tb->cqsz);
+        munmap (tb->sqes, tb->n * sizeof (struct io_uring_sqe));
+        close (tb->fd);
+    }
+#endif
+    free (tb);
+    tb = NULL;
+}
+
+
+/*
+ * iob_reserve: make sure @n entries can be queued without a submission in
+ * between, as needed by a chain of linked requests.
+ */
+void
+iob_reserve (iobatch *b, unsigned n)
+{
+#ifdef HAVE_IO_URING
+    if (b->fd >= 0 && b->queued + n > b->n)
+        iob_submit (b);
+#endif
+}
+
+
+/*
+ * iob_submit: hand the queued requests to the kernel and wait for all of
+ * them to complete. Returns the number of requests completed.
+ */
+int
+iob_submit (iobatch *b)
+{
+    unsigned done = 0;
+
+    assert (b != NULL);
+
+#ifdef HAVE_IO_URING
+    unsigned sub = 0;
+
+    while (done < b->queued)
+    {
+        unsigned h = *b->cqhead;
+        long r = syscall (__NR_io_uring_enter, b->fd, b->queued - sub,
+                          b->queued - done, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        st_sys (1);
+
+        if (r >= 0)
+            sub += r;   /* the kernel stops at an invalid entry */
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            err (-1, "could not submit I/O requests");
+
+        while (h != __atomic_load_n (b->cqtail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &b->cqes[h & *b->cqmask];
+
+            if (cqe->user_data)
+                *(int *)(unsigned long) cqe->user_data = cqe->res;
+            h++;
+            done++;
+        }
+        __atomic_store_n (b->cqhead, h, __ATOMIC_RELEASE);
+    }
+#endif
+    b->queued = 0;
+
+    return done;
+}
+
+
+/* plain system call result, in the -errno convention of io_uring */
+static int
+iob_res (long r)
+{
+    st_sys (1);
+
+    return r < 0 ? -errno : r;
+}
+
+
+/*
+ * iob_statx: queue a statx(2) request. @name and @stx must stay valid until
+ * the batch is submitted.
+ */
+void
+iob_statx (iobatch *b, int dfd, const char *name, int flags, unsigned mask,
+           struct statx *stx, int *res)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe *sqe = iob_sqe (b, IORING_OP_STATX, 0, res);
+
+    if (sqe != NULL)
+    {
+        sqe->fd = dfd;
+        sqe->addr = (unsigned long) name;
+        sqe->len = mask;
+        sqe->off = (unsigned long) stx;
+        sqe->statx_flags = flags;
+        return;
+    }
+#endif
+    *res = iob_res (statx (dfd, name, flags, mask, stx));
+}
+
+
+/*
+ * iob_unlinkat: queue an unlinkat(2) request. @name must stay valid until
+ * the batch is submitted.
+ */
+void
+iob_unlinkat (iobatch *b, int dfd, const char *name, int flags, int *res)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe *sqe = iob_sqe (b, IORING_OP_UNLINKAT, 0, res);
+
+    if (sqe != NULL)
+    {
+        sqe->fd = dfd;
+        sqe->addr = (unsigned long) name;
+        sqe->unlink_flags = flags;
+        return;
+    }
+#endif
+    *res = iob_res (unlinkat (dfd, name, flags));
+}
+
+
+/*
+ * iob_write: queue a write(2) of @len bytes at offset @off. With IOB_LINK
+ * in @flags, the next request starts only after this one completes.
+ */
+void
+iob_write (iobatch *b, int fd, const void *buf, size_t len, off_t off,
+           int flags, int *res)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe *sqe = iob_sqe (b, IORING_OP_WRITE, flags, res);
+
+    if (sqe != NULL)
+    {
+        sqe->fd = fd;
+        sqe->addr = (unsigned long) buf;
+        sqe->len = len;
+        sqe->off = off;
+        return;
+    }
+#endif
+    *res = iob_res (pwrite (fd, buf, len, off));
+}
+
+
+/*
+ * iob_fsync: queue an fsync(2) request.
+ */
+void
+iob_fsync (iobatch *b, int fd, int flags, int *res)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe *sqe = iob_sqe (b, IORING_OP_FSYNC, flags, res);
+
+    if (sqe != NULL)
+    {
+        sqe->fd = fd;
+        return;
+    }
+#endif
+    *res = iob_res (fsync (fd));
+}
+
+
+/*
+ * iob_close: queue a close(2) request.
+ */
+void
+iob_close (iobatch *b, int fd, int flags, int *res)
+{
+#ifdef HAVE_IO_URING
+    struct io_uring_sqe *sqe = iob_sqe (b, IORING_OP_CLOSE, flags, res);
+
+    if (sqe != NULL)
+    {
+        sqe->fd = fd;
+        return;
+    }
+#endif
+    *res = iob_res (close (fd));
+}
+
+
+/*
+ * statx_stat: fill a stat structure from the result of statx(2).
+ */
+void
+statx_stat (const struct statx *stx, struct stat *st)
+{
+    assert (stx != NULL && st != NULL);
+
+    memset (st, 0, sizeof (*st));
+    st->st_dev = makedev (stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_rdev = makedev (stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size = stx->stx_size;
+    st->st_blksize = stx->stx_blksize;
+    st->st_blocks = stx->stx_blocks;
+    st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
@@ -0,0 +1,517 @@
+/*
+ * jobs.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Journal of the moves across file systems, in Trash/ptrash.jobs. A move
+ * queued to the --async worker, or a directory or large file being copied
+ * to trash, has a file <name>.job there, named after its entry in trash:
+ *
+ *   [Trash Job]
+ *   Path=<original path>
+ *   Pid=<worker>           once a process has taken it over
+ *   Started=<time>         once the process is copying it
+ *   Copy=<dev>:<ino> <size> <mtime> <offset>
+ *
+ * A Copy line is appended each time a large file of the move is copied up
+ * to <offset>, and its copy is on disk that far. The file goes when the
+ * move is done, after the source is removed and the trash info record is
+ * written. A process holds a flock(2) lock on Trash/ptrash.jobs/<pid>.lock
+ * while it runs; a job of a process gone is stopped, and is taken up where
+ * it stopped by the next move of its file, or by --resume. The background
+ * worker appends its messages to Trash/ptrash.jobs/log.
+ */
+
+#include <ptrash.h>
+#include <sys/file.h>       /* for flock */
+#include <time.h>
+
+#define J_DIR           "../ptrash.jobs"    /* from the info directory */
+#define J_EXT           ".job"
+
+/* a file copied in part by a stopped move */
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    off_t off;
+} jcopy;
+
+/* a move being journaled */
+struct tjob
+{
+    char name[NAME_MAX + 1];
+    jcopy *c;               /* of the run that stopped, to be taken up */
+    size_t nc;
+};
+
+static int jfd = -1;        /* Trash/ptrash.jobs */
+
+
+/*
+ * j_dir: returns the descriptor of the journal of the home trash, creating
+ * it when @create is set, or -1 if there is none.
+ */
+static int
+j_dir (short create)
+{
+    char *p = NULL;
+
+    if (jfd >= 0)
+        return jfd;
+    if ((p = build_path (trash_get (0)->info, J_DIR)) == NULL)
+        return -1;
+    if (create && mkdir (p, S_IRWXU) < 0 && errno != EEXIST)
+        warn ("could not create directory `%s'", p);
+    jfd = open (p, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    free (p);
+
+    return jfd;
+}
+
+
+/* j_append: append the line @ln to the job file of trash entry @name */
+static int
+j_append (const char *name, const char *ln, int flags)
+{
+    int fd = -1, ret = 0;
+    char nm[NAME_MAX + 1];
+
+    snprintf (nm, sizeof (nm), "%s" J_EXT, name);
+    if (j_dir (flags & O_CREAT) < 0
+        || (fd = openat (jfd, nm, O_WRONLY|O_APPEND|O_CLOEXEC|flags,
+                         S_IRUSR|S_IWUSR)) < 0)
+        return -1;
+    if (write (fd, ln, strlen (ln)) != (ssize_t) strlen (ln))
+        ret = -1;
+    close (fd);
+
+    return ret;
+}
+
+
+/*
+ * job_add: journal the move of @path to the trash entry @name, which is
+ * left to the background worker. Returns 0 on success and -1 on error.
+ */
+int
+job_add (const char *name, const char *path)
+{
+    int ret = 0;
+    char *ln = NULL;
+
+    assert (name != NULL && path != NULL);
+
+    if ((ln = malloc (strlen (path) + 32)) == NULL)
+        return -1;
+    sprintf (ln, "[Trash Job]\nPath=%s\n", path);
+    if ((ret = j_append (name, ln, O_CREAT|O_TRUNC)) < 0)
+        warn ("could not journal the move of `%s'", path);
+    free (ln);
+
+    return ret;
+}
+
+
+/* j_lock: take the lock of this process, held until it exits */
+static void
+j_lock (void)
+{
+    char nm[32];
+    static int lk = -1;
+
+    if (lk < 0 && j_dir (1) >= 0)
+    {
+        snprintf (nm, sizeof (nm), "%ld.lock", (long) getpid ());
+        if ((lk = openat (jfd, nm, O_RDWR|O_CREAT|O_CLOEXEC,
+                          S_IRUSR|S_IWUSR)) >= 0)
+            flock (lk, LOCK_EX);
+    }
+}
+
+
+/*
+ * job_take: the worker process has taken over the job of entry @name. The
+ * first call takes the lock of the worker, held until it exits.
+ */
+void
+job_take (const char *name)
+{
+    char ln[32];
+
+    j_lock ();
+    snprintf (ln, sizeof (ln), "Pid=%ld\n", (long) getpid ());
+    j_append (name, ln, 0);
+}
+
+
+/* job_fini: the process is done with its jobs, drop its lock */
+void
+job_fini (void)
+{
+    char nm[32];
+
+    snprintf (nm, sizeof (nm), "%ld.lock", (long) getpid ());
+    if (jfd >= 0)
+        unlinkat (jfd, nm, 0);
+}
+
+
+/* j_alive: returns 1 if the worker @pid holds its lock */
+static int
+j_alive (long pid)
+{
+    int fd = -1, ret = 0;
+    char nm[32];
+
+    snprintf (nm, sizeof (nm), "%ld.lock", pid);
+    if ((fd = openat (jfd, nm, O_RDONLY|O_CLOEXEC)) < 0)
+        return 0;
+    ret = flock (fd, LOCK_SH|LOCK_NB) < 0 && errno == EWOULDBLOCK;
+    close (fd);
+
+    return ret;
+}
+
+
+/* job_start: the worker starts moving entry @name */
+void
+job_start (const char *name)
+{
+    char ln[48];
+
+    snprintf (ln, sizeof (ln), "Started=%ld\n", (long) time (NULL));
+    j_append (name, ln, 0);
+}
+
+
+/* job_done: the move to entry @name is done, drop its job */
+void
+job_done (const char *name)
+{
+    char nm[NAME_MAX + 1];
+
+    snprintf (nm, sizeof (nm), "%s" J_EXT, name);
+    if (j_dir (0) >= 0 && unlinkat (jfd, nm, 0) < 0)
+        warn ("could not remove job `%s'", nm);
+}
+
+
+/*
+ * j_read: read the job file @nm: its original path in @path, to be freed,
+ * the last pid that took it in @pid, 0 if none did, and with @j set, its
+ * Copy lines into @j. Returns 1 if it was started, 0 if it was not, and -1
+ * if it could not be read.
+ */
+static int
+j_read (const char *nm, char **path, long *pid, tjob *j)
+{
+    int fd = -1, ret = 0;
+    size_t sz = 0;
+    char *ln = NULL;
+    FILE *fp = NULL;
+    jcopy *p = NULL;
+    unsigned long long dev = 0, ino = 0;
+    long long size = 0, mtime = 0, off = 0;
+
+    *path = NULL;
+    *pid = 0;
+    if ((fd = openat (jfd, nm, O_RDONLY|O_CLOEXEC)) < 0
+        || (fp = fdopen (fd, "r")) == NULL)
+    {
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+    while (getline (&ln, &sz, fp) > 0)
+    {
+        ln[strcspn (ln, "\n")] = '\0';
+        if (!strncmp (ln, "Path=", 5))
+        {
+            free (*path);
+            *path = strdup (ln + 5);
+        }
+        else if (!strncmp (ln, "Pid=", 4))
+            *pid = atol (ln + 4);
+        else if (!strncmp (ln, "Started=", 8))
+            ret = 1;
+        else if (j != NULL && sscanf (ln, "Copy=%llu:%llu %lld %lld %lld",
+                                      &dev, &ino, &size, &mtime, &off) == 5
+                 && (p = realloc (j->c, (j->nc + 1) * sizeof (jcopy))) != NULL)
+        {
+            j->c = p;
+            p[j->nc].dev = dev;
+            p[j->nc].ino = ino;
+            p[j->nc].size = size;
+            p[j->nc].mtime = mtime;
+            p[j->nc++].off = off;
+        }
+    }
+    fclose (fp);
+    free (ln);
+
+    return ret;
+}
+
+
+/*
+ * job_close: release the job @j; with @done set, the move is done and its
+ * job goes from the journal, else it is left to be taken up later.
+ */
+void
+job_close (tjob *j, short done)
+{
+    if (j == NULL)
+        return;
+    if (done)
+        job_done (j->name);
+    free (j->c);
+    free (j);
+}
+
+
+/*
+ * job_open: journal the move of @path to the trash entry @name, copied
+ * across file systems by this process. A job of @name left by a move of
+ * @path that stopped is taken over, along with the offsets its large files
+ * were copied to. Returns 0 with the job in @jp, or NULL if there is no
+ * journal, and -1 if another process is moving @path now.
+ */
+int
+job_open (const char *name, const char *path, tjob **jp)
+{
+    long pid = 0;
+    char *ln = NULL, *p = NULL, nm[NAME_MAX + 1];
+    tjob *j = NULL;
+
+    assert (name != NULL && path != NULL && jp != NULL);
+
+    *jp = NULL;
+    if (j_dir (1) < 0 || (j = calloc (1, sizeof (tjob))) == NULL)
+        return 0;
+    snprintf (j->name, sizeof (j->name), "%s", name);
+    snprintf (nm, sizeof (nm), "%s" J_EXT, name);
+
+    if (j_read (nm, &p, &pid, j) >= 0 && p != NULL && !strcmp (p, path))
+    {
+        free (p);
+        if (pid > 0 && pid != getpid () && j_alive (pid))
+        {
+            warnx ("`%s' is being moved by process %ld", path, pid);
+            job_close (j, 0);
+            return -1;
+        }
+        if (pid > 0 && pid != getpid ())
+        {
+            snprintf (nm, sizeof (nm), "%ld.lock", pid);
+            unlinkat (jfd, nm, 0);      /* left by the process gone */
+        }
+        if (pid != getpid ())
+            job_take (name);
+        job_start (name);
+        *jp = j;
+        return 0;
+    }
+
+    /* none, or one of another file of that name */
+    free (p);
+    free (j->c);
+    j->c = NULL;
+    j->nc = 0;
+    j_lock ();
+    if ((ln = malloc (strlen (path) + 96)) == NULL)
+        err (-1, "could not allocate memory");
+    sprintf (ln, "[Trash Job]\nPath=%s\nPid=%ld\nStarted=%ld\n", path,
+             (long) getpid (), (long) time (NULL));
+    if (j_append (name, ln, O_CREAT|O_TRUNC) < 0)
+        warn ("could not journal the move of `%s'", path);
+    free (ln);
+    *jp = j;
+
+    return 0;
+}
+
+
+/*
+ * job_offset: returns the offset up to which the file open on @fd was
+ * copied by the stopped run @j took over, or 0 if it was not copied in
+ * part, or has changed since.
+ */
+off_t
+job_offset (tjob *j, int fd)
+{
+    size_t i = 0;
+    off_t off = 0;
+    struct stat sb;
+
+    assert (j != NULL);
+
+    if (!j->nc || fstat (fd, &sb) < 0)
+        return 0;
+    for (i = 0; i < j->nc; i++)
+        if (j->c[i].dev == sb.st_dev && j->c[i].ino == sb.st_ino
+            && j->c[i].size == sb.st_size && j->c[i].mtime == sb.st_mtime
+            && j->c[i].off <= sb.st_size)
+            off = j->c[i].off;  /* the last one is the furthest */
+
+    return off;
+}
+
+
+/*
+ * job_mark: journal that the file of @sb is copied up to @off, and that its
+ * copy is on disk that far.
+ */
+void
+job_mark (tjob *j, const struct stat *sb, off_t off)
+{
+    char ln[128];
+
+    assert (j != NULL && sb != NULL);
+
+    snprintf (ln, sizeof (ln), "Copy=%llu:%llu %lld %lld %lld\n",
+              (unsigned long long) sb->st_dev, (unsigned long long) sb->st_ino,
+              (long long) sb->st_size, (long long) sb->st_mtime,
+              (long long) off);
+    j_append (j->name, ln, 0);
+}
+
+
+/*
+ * job_resume: take up the stopped jobs, those whose process is gone, with
+ * @fn called on the trash name and original path of each. The locks left
+ * by processes gone are removed. Returns the number of jobs taken up.
+ */
+long
+job_resume (void (*fn) (const char *, const char *))
+{
+    long n = 0, i = 0, pid = 0;
+    size_t l = 0;
+    char *path = NULL, **names = NULL, **paths = NULL;
+    DIR *d = NULL;
+    struct dirent *de = NULL;
+
+    assert (fn != NULL);
+
+    if (j_dir (0) < 0 || (d = fdopendir (dup (jfd))) == NULL)
+        return 0;
+    rewinddir (d);
+    while ((de = readdir (d)) != NULL)
+    {
+        l = strlen (de->d_name);
+        if (l > 5 && !strcmp (de->d_name + l - 5, ".lock")
+            && (pid = atol (de->d_name)) != getpid () && !j_alive (pid))
+            unlinkat (jfd, de->d_name, 0);
+        if (l <= strlen (J_EXT) || strcmp (de->d_name + l - strlen (J_EXT),
+                                           J_EXT)
+            || j_read (de->d_name, &path, &pid, NULL) < 0 || path == NULL
+            || (pid > 0 && j_alive (pid)))
+        {
+            free (path);
+            path = NULL;
+            continue;
+        }
+
+        /* taken up once the directory is read, as that changes it */
+        if ((names = realloc (names, (n + 1) * sizeof (char *))) == NULL
+            || (paths = realloc (paths, (n + 1) * sizeof (char *))) == NULL
+            || (names[n] = strndup (de->d_name, l - strlen (J_EXT))) == NULL)
+            err (-1, "could not allocate memory");
+        paths[n++] = path;
+        path = NULL;
+    }
+    closedir (d);
+
+    for (i = 0; i < n; i++)
+    {
+        fn (names[i], paths[i]);
+        free (names[i]);
+        free (paths[i]);
+    }
+    free (names);
+    free (paths);
+
+    return n;
+}
+
+
+/*
+ * job_log: returns a descriptor of the log of the background workers, or
+ * -1 on error.
+ */
+int
+job_log (void)
+{
+    if (j_dir (1) < 0)
+        return -1;
+
+    return openat (jfd, "log", O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,
+                   S_IRUSR|S_IWUSR);
+}
+
+
+/*
+ * job_status: print the moves left to the background workers: their state,
+ * trash name and original path. A job is `queued' until its worker starts
+ * it, `running' while it is copied and `stopped' if its worker is gone
+ * before it was done. Returns the number of jobs, or -1 on error.
+ */
+long
+job_status (void)
+{
+    int started = 0;
+    long n = 0, pid = 0;
+    char *path = NULL;
+    const char *st = NULL;
+    DIR *d = NULL;
+    struct dirent *de = NULL;
+
+    if (j_dir (0) < 0)
+        return 0;   /* nothing was ever queued */
+    if ((d = fdopendir (dup (jfd))) == NULL)
+    {
+        warn ("could not read the jobs of trash");
+        return -1;
+    }
+    rewinddir (d);
+    while ((de = readdir (d)) != NULL)
+    {
+        size_t l = strlen (de->d_name);
+
+        if (l <= strlen (J_EXT) || strcmp (de->d_name + l - strlen (J_EXT),
+                                           J_EXT)
+            || (started = j_read (de->d_name, &path, &pid, NULL)) < 0)
+            continue;
+
+        if (pid > 0 && !j_alive (pid))
+            st = "stopped";
+        else
+            st = started ? "running" : "queued";
+        de->d_name[l - strlen (J_EXT)] = '\0';
+        printf ("%-8s %s  %s\n", st, de->d_name, path ? path : "");
+        free (path);
+        path = NULL;
+        n++;
+    }
+    closedir (d);
+
+    return n;
+}
@@ -0,0 +1,352 @@
+/*
+ * pathlist.c -- move unwanted files to trash; This file is part of the
+ * program 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Paths read by --from-file, one per line or terminated by NUL bytes with
+ * -0. The whole input is read first. Each path is split into its parent
+ * directory and name; a parent is resolved with realpath(3) and stat(2)
+ * once, however many of the paths it holds. The paths are then sorted by
+ * the device, and the resolved path, of their parent, and handed out one
+ * directory at a time, their entries stat'ed in batches relative to it.
+ */
+
+#include <ptrash.h>
+#include <stdint.h>
+#include <limits.h>         /* for PATH_MAX */
+
+/* a path of the input */
+typedef struct
+{
+    char *dir;              /* parent as given, "" for the root */
+    char *name;
+    uint32_t parent;        /* index of the resolved parent */
+} pent;
+
+/* a parent directory of the input */
+typedef struct
+{
+    char *path;             /* resolved path, NULL if it was not found */
+    dev_t dev;
+} pdir;
+
+struct plist
+{
+    char *buf;              /* the input */
+    size_t len;
+    pent *e;
+    size_t n;
+    pdir *d;
+    size_t nd;
+    size_t next;            /* next entry to hand out */
+    size_t bbeg, bend;      /* entries of the stat'ed batch */
+    int dfd;                /* parent directory of the batch */
+    size_t dcur;            /* its index, or nd */
+    struct statx stx[IOB_DEPTH];
+    int res[IOB_DEPTH];
+    char path[PATH_MAX + NAME_MAX + 2];
+};
+
+
+/* pl_split: split the path @p of the input into its parent and name */
+static void
+pl_split (pent *e, char *p)
+{
+    char *s = NULL;
+    size_t l = strlen (p);
+
+    while (l > 1 && p[l - 1] == '/')
+        p[--l] = '\0';
+    if ((s = strrchr (p, '/')) == NULL)
+    {
+        e->dir = ".";
+        e->name = p;
+    }
+    else
+    {
+        *s = '\0';
+        e->dir = p;     /* "" for a file at the root */
+        e->name = s + 1;
+    }
+}
+
+
+/*
+ * pl_read: read the paths in @file, "-" for the standard input, separated
+ * by the byte @delim. Returns the list of paths, or NULL on error.
+ */
+plist *
+pl_read (const char *file, int delim)
+{
+    FILE *fp = NULL;
+    plist *pl = NULL;
+    size_t cap = 0, i = 0, ecap = 0;
+    ssize_t r = 0;
+    char *p = NULL;
+
+    assert (file != NULL);
+
+    if (!strcmp (file, "-"))
+        fp = stdin;
+    else if ((fp = fopen (file, "re")) == NULL)
+    {
+        warn ("could not open file `%s'", file);
+        return NULL;
+    }
+    if ((pl = calloc (1, sizeof (plist))) == NULL)
+        err (-1, "could not allocate memory");
+    pl->dfd = -1;
+
+    /* read it all in one buffer, the paths are NUL terminated in place */
+    for (;;)
+    {
+        if (cap - pl->len < 65536
+            && (pl->buf = realloc (pl->buf, cap = cap ? cap * 2 : 1 << 20))
+               == NULL)
+            err (-1, "could not allocate memory");
+        if ((r = fread (pl->buf + pl->len, 1, cap - pl->len - 1, fp)) <= 0)
+            break;
+        pl->len += r;
+    }
+    if (ferror (fp))
+        warn ("could not read file `%s'", file);
+    if (fp != stdin)
+        fclose (fp);
+    pl->buf[pl->len] = '\0';
+
+    for (i = 0, p = pl->buf; i <= pl->len; i++)
+    {
+        if (i < pl->len && pl->buf[i] != delim)
+            continue;
+        pl->buf[i] = '\0';
+        if (*p)
+        {
+            if (pl->n == ecap && (pl->e = realloc (pl->e, (ecap = ecap
+                                  ? ecap * 2 : 4096) * sizeof (pent))) == NULL)
+                err (-1, "could not allocate memory");
+            pl->e[pl->n++].name = p;
+        }
+        p = pl->buf + i + 1;
+    }
+
+    return pl;
+}
+
+
+/* pl_size: returns the number of paths in @pl */
+size_t
+pl_size (plist *pl)
+{
+    return pl->n;
+}
+
+
+/* pl_path: returns the path @i of @pl as it was read, before pl_sort */
+char *
+pl_path (plist *pl, size_t i)
+{
+    assert (i < pl->n && pl->d == NULL);
+
+    return pl->e[i].name;
+}
+
+
+static int
+pl_dircmp (const void *a, const void *b)
+{
+    const pent *x = a, *y = b;
+
+    return strcmp (x->dir, y->dir);
+}
+
+
+static pdir *pl_dirs = NULL;    /* for pl_cmp */
+
+static int
+pl_cmp (const void *a, const void *b)
+{
+    const pent *x = a, *y = b;
+    const pdir *dx = &pl_dirs[x->parent], *dy = &pl_dirs[y->parent];
+    int r = 0;
+
+    if (dx->dev != dy->dev)
+        return dx->dev < dy->dev ? -1 : 1;
+    if (x->parent != y->parent
+        && (r = strcmp (dx->path ? dx->path : "", dy->path ? dy->path : "")))
+        return r;
+    if (x->parent != y->parent)
+        return x->parent < y->parent ? -1 : 1;
+
+    return strcmp (x->name, y->name);
+}
+
+
+/*
+ * pl_sort: resolve the parent directories of the paths, and sort the paths
+ * by the device and resolved path of their parent, then by name. A path
+ * ending in `.' or `..' is resolved whole first. Returns 0 on success.
+ */
+int
+pl_sort (plist *pl)
+{
+    size_t i = 0, cap = 0;
+    char *r = NULL;
+    struct stat sb;
+
+    assert (pl != NULL);
+
+    for (i = 0; i < pl->n; i++)
+    {
+        pent *e = &pl->e[i];
+        char *b = strrchr (e->name, '/');
+
+        b = b ? b + 1 : e->name;
+        if ((!strcmp (b, ".") || !strcmp (b, ".."))
+            && (r = realpath (e->name, NULL)) != NULL)
+            e->name = r;    /* kept to the end of the run */
+        pl_split (e, e->name);
+        if (!*e->name)
+            e->name = "/";  /* the root, found not to be a file later */
+    }
+    qsort (pl->e, pl->n, sizeof (pent), pl_dircmp);
+
+    /* one resolution per parent */
+    for (i = 0; i < pl->n; i++)
+    {
+        pent *e = &pl->e[i];
+
+        if (!pl->nd || strcmp (e->dir, pl->e[i - 1].dir))
+        {
+            pdir *d = NULL;
+
+            if (pl->nd == cap && (pl->d = realloc (pl->d, (cap = cap ? cap * 2
+                                  : 1024) * sizeof (pdir))) == NULL)
+                err (-1, "could not allocate memory");
+            d = &pl->d[pl->nd++];
+            d->path = realpath (*e->dir ? e->dir : "/", NULL);
+            d->dev = d->path != NULL && !stat (d->path, &sb) ? sb.st_dev : 0;
+        }
+        e->parent = pl->nd - 1;
+    }
+
+    pl_dirs = pl->d;
+    qsort (pl->e, pl->n, sizeof (pent), pl_cmp);
+    pl_dirs = NULL;
+    pl->dcur = pl->nd;
+
+    return 0;
+}
+
+
+/*
+ * pl_batch: stat the entries from pl->next on, up to IOB_DEPTH of them in
+ * the same parent directory, with one submission.
+ */
+static void
+pl_batch (plist *pl)
+{
+    size_t i = 0;
+    pent *e = &pl->e[pl->next];
+    pdir *d = &pl->d[e->parent];
+    iobatch *b = iob_get ();
+
+    st_begin (PH_STAT);
+    if (pl->dcur != e->parent)
+    {
+        if (pl->dfd >= 0)
+            close (pl->dfd);
+        pl->dfd = d->path == NULL ? -1 : open (d->path,
+                                       O_PATH|O_DIRECTORY|O_CLOEXEC);
+        pl->dcur = e->parent;
+    }
+    for (i = 0; i < IOB_DEPTH && pl->next + i < pl->n
+                && e[i].parent == e->parent; i++)
+    {
+        pl->res[i] = -ENOENT;
+        if (pl->dfd >= 0 && strcmp (e[i].name, "/"))
+            iob_statx (b, pl->dfd, e[i].name, AT_SYMLINK_NOFOLLOW,
+                       STATX_BASIC_STATS, &pl->stx[i], &pl->res[i]);
+    }
+    iob_submit (b);
+    st_end ();
+    pl->bbeg = pl->next;
+    pl->bend = pl->next + i;
+}
+
+
+/*
+ * pl_next: hand out the next path of @pl in sorted order: its absolute
+ * path in @path, valid until the next call, and its stat in @sb. Returns 1
+ * for a path, 0 at the end, and -1 for a path that could not be found.
+ */
+int
+pl_next (plist *pl, char **path, struct stat *sb)
+{
+    size_t i = 0;
+    pent *e = NULL;
+    pdir *d = NULL;
+
+    assert (pl != NULL && path != NULL && sb != NULL);
+
+    if (pl->next >= pl->n)
+    {
+        if (pl->dfd >= 0)
+            close (pl->dfd);
+        pl->dfd = -1;
+        return 0;
+    }
+    if (pl->next >= pl->bend)
+        pl_batch (pl);
+
+    i = pl->next - pl->bbeg;
+    e = &pl->e[pl->next++];
+    d = &pl->d[e->parent];
+    snprintf (pl->path, sizeof (pl->path), "%s/%s",
+              d->path != NULL && strcmp (d->path, "/") ? d->path : "",
+              e->name);
+    *path = pl->path;
+    if (pl->res[i] < 0)
+    {
+        errno = -pl->res[i];
+        warn ("could not locate file `%s'", d->path ? pl->path : e->name);
+        return -1;
+    }
+    statx_stat (&pl->stx[i], sb);
+
+    return 1;
+}
+
+
+/* pl_free: release the list @pl */
+void
+pl_free (plist *pl)
+{
+    size_t i = 0;
+
+    if (pl == NULL)
+        return;
+    for (i = 0; i < pl->nd; i++)
+        free (pl->d[i].path);
+    if (pl->dfd >= 0)
+        close (pl->dfd);
+    free (pl->d);
+    free (pl->e);
+    free (pl->buf);
+    free (pl);
+}
@@ -0,0 +1,255 @@
+/*
+ * pool.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <ptrash.h>
+#include <pthread.h>
+
+/* a job queued to the pool */
+typedef struct
+{
+    void (*fn) (void *);
+    void *arg;
+} job;
+
+/*
+ * per worker double ended queue. The owner pushes and pops jobs at the
+ * bottom, idle workers steal the oldest ones from the top.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    job *q;
+    size_t cap, top, bot;
+} deque;
+
+static struct
+{
+    int n;
+    pthread_t *tid;
+    deque *dq;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* signalled when a job is queued */
+    pthread_cond_t done;    /* signalled when pending drops to zero */
+    long pending;           /* jobs queued or running */
+    long queued;            /* jobs sitting in the deques */
+    unsigned next;          /* deque for jobs queued by non workers */
+    short stop;
+} pool;
+
+static __thread int self = -1;
+
+
+static void
+dq_push (deque *d, job *j)
+{
+    pthread_mutex_lock (&d->lock);
+    if (d->bot - d->top == d->cap)
+    {
+        size_t i = 0, cap = d->cap ? d->cap * 2 : 64;
+        job *q = malloc (cap * sizeof (job));
+
+        if (q == NULL)
+            err (-1, "could not queue job");
+        for (i = d->top; i < d->bot; i++)
+            q[i % cap] = d->q[i % d->cap];
+        free (d->q);
+        d->q = q;
+        d->cap = cap;
+    }
+    d->q[d->bot++ % d->cap] = *j;
+    pthread_mutex_unlock (&d->lock);
+}
+
+
+static int
+dq_pop (deque *d, job *j, short steal)
+{
+    int ret = 0;
+
+    pthread_mutex_lock (&d->lock);
+    if (d->bot > d->top)
+    {
+        *j = steal ? d->q[d->top++ % d->cap] : d->q[--d->bot % d->cap];
+        ret = 1;
+    }
+    pthread_mutex_unlock (&d->lock);
+
+    return ret;
+}
+
+
+/*
+ * get_job: take a job from own deque, or steal one from the others.
+ */
+static int
+get_job (job *j)
+{
+    int i = 0;
+
+    if (dq_pop (&pool.dq[self], j, 0))
+        goto out;
+    for (i = 1; i < pool.n; i++)
+        if (dq_pop (&pool.dq[(self + i) % pool.n], j, 1))
+            goto out;
+
+    return 0;
+out:
+    __atomic_sub_fetch (&pool.queued, 1, __ATOMIC_ACQ_REL);
+    return 1;
+}
+
+
+static void *
+worker (void *arg)
+{
+    job j;
+
+    self = (int)(long) arg;
+    for (;;)
+    {
+        if (get_job (&j))
+        {
+            j.fn (j.arg);
+            if (!__atomic_sub_fetch (&pool.pending, 1, __ATOMIC_ACQ_REL))
+            {
+                pthread_mutex_lock (&pool.lock);
+                pthread_cond_broadcast (&pool.done);
+                pthread_mutex_unlock (&pool.lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock (&pool.lock);
+        while (!__atomic_load_n (&pool.queued, __ATOMIC_ACQUIRE) && !pool.stop)
+            pthread_cond_wait (&pool.work, &pool.lock);
+        if (pool.stop)
+        {
+            pthread_mutex_unlock (&pool.lock);
+            break;
+        }
+        pthread_mutex_unlock (&pool.lock);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * pool_init: start @n worker threads.
+ */
+int
+pool_init (int n)
+{
+    int i = 0;
+
+    assert (n > 0);
+
+    pool.n = n;
+    pool.tid = calloc (n, sizeof (pthread_t));
+    pool.dq = calloc (n, sizeof (deque));
+    if (pool.tid == NULL || pool.dq == NULL)
+        return -1;
+
+    pthread_mutex_init (&pool.lock, NULL);
+    pthread_cond_init (&pool.work, NULL);
+    pthread_cond_init (&pool.done, NULL);
+    for (i = 0; i < n; i++)
+        pthread_mutex_init (&pool.dq[i].lock, NULL);
+    for (i = 0; i < n; i++)
+    {
+        if (pthread_create (&pool.tid[i], NULL, worker, (void *)(long) i))
+        {
+            warnx ("could not start worker thread");
+            pool.n = i;
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * pool_submit: queue a job. Workers push to their own deque, others spread
+ * jobs over the deques in turn.
+ *
+ * fn: function to run.
+ * arg: argument passed to @fn.
+ */
+void
+pool_submit (void (*fn) (void *), void *arg)
+{
+    job j = { fn, arg };
+    int i = self;
+
+    assert (fn != NULL && pool.n > 0);
+
+    if (i < 0)
+        i = __atomic_fetch_add (&pool.next, 1, __ATOMIC_RELAXED) % pool.n;
+
+    __atomic_add_fetch (&pool.pending, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch (&pool.queued, 1, __ATOMIC_ACQ_REL);
+    dq_push (&pool.dq[i], &j);
+
+    pthread_mutex_lock (&pool.lock);
+    pthread_cond_signal (&pool.work);
+    pthread_mutex_unlock (&pool.lock);
+}
+
+
+/*
+ * pool_wait: wait until all the queued jobs, and the jobs queued by them,
+ * have finished.
+ */
+void
+pool_wait (void)
+{
+    pthread_mutex_lock (&pool.lock);
+    while (__atomic_load_n (&pool.pending, __ATOMIC_ACQUIRE))
+        pthread_cond_wait (&pool.done, &pool.lock);
+    pthread_mutex_unlock (&pool.lock);
+}
+
+
+/*
+ * pool_fini: stop the worker threads and release the pool.
+ */
+void
+pool_fini (void)
+{
+    int i = 0;
+
+    if (!pool.n)
+        return;
+
+    pthread_mutex_lock (&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast (&pool.work);
+    pthread_mutex_unlock (&pool.lock);
+
+    for (i = 0; i < pool.n; i++)
+    {
+        pthread_join (pool.tid[i], NULL);
+        free (pool.dq[i].q);
+    }
+    free (pool.dq);
+    free (pool.tid);
+    pool.n = 0;
+}
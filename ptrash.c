@@ -20,18 +20,101 @@
 
 #include <ptrash.h>
 #include <ptrashdb.h>
+#include <limits.h>         /* for LLONG_MAX */
+#include <sys/resource.h>   /* for setrlimit */
+#include <sys/wait.h>       /* for waitpid */
+
+#ifndef HAVE_RENAMEAT2
+#include <sys/syscall.h>
+
+static int
+renameat2 (int ofd, const char *old, int nfd, const char *new, unsigned flags)
+{
+    return syscall (SYS_renameat2, ofd, old, nfd, new, flags);
+}
+#endif
 
 extern char *tdb;
+extern short tsync;
+extern short cdirect;
 extern int opterr, optind;
 
-char *trsh = NULL, *pdir = NULL;
+char *trsh = NULL;  /* files directory of the trash in use */
+int tfd = -1;       /* descriptor of trsh */
 char *prog = NULL, *home = NULL, *pwd = NULL;
 
-short mode = 0, perm = 0, omask = 0;
-short OVER_WRITE = 0, RESTORE_DIR = 0, MOVE_DIR = 0, DELETE_DIR = 0;
+dev_t tdev = 0;     /* device of the trsh directory */
+short mode = 0, omask = 0;
+int jobs = 1;       /* number of worker threads, -j */
+static short lkey = SORT_DATE, lfmt = LIST_TEXT;   /* --sort, --list */
+static long long qsize = -1;    /* --max-size of trash in bytes, -1 for none */
+static long long qage = -1;     /* --max-age of files in seconds */
+static time_t tstart = 0;       /* files deleted since are not evicted */
+static short sched = SCHED_NONE;    /* --schedule of directory entries */
+static short sfmt = STATS_NONE;     /* --stats */
+static short htrash = 0;        /* --home-trash for files of all mounts */
+
+/* a move left to the background worker by --async */
+typedef struct
+{
+    char *path;
+    struct stat sb;
+    trash *trash;
+} ajob;
+
+static ajob *aq = NULL;
+static int naq = 0;
+static short aworker = 0;       /* moving the queued files */
+static char *pfile = NULL;      /* --from-file, "-" for stdin */
+static int pdelim = '\n';       /* separator of its paths, -0 for NUL */
+
+/* a piece of verbose output, followed by that of a child task */
+typedef struct oseg
+{
+    char *buf;
+    size_t len;
+    struct mtask *child;
+    struct oseg *next;
+} oseg;
+
+/*
+ * a directory or a large file moved or deleted by a pool worker. Directories
+ * queue their sub-directories, and large files, as child tasks; a directory
+ * is removed once all of its children have finished.
+ */
+typedef struct mtask
+{
+    mctx ctx;
+    char *path;             /* path of the file, relative to pfd */
+    struct stat sb;
+    int pfd;                /* directory holding the file */
+    int fd;                 /* open directory, children are relative to it */
+    int lfd;                /* destination of the directory's entries */
+    char *spath;            /* path of the directory, for messages */
+    char *dspath;           /* path of its destination */
+    struct mtask *parent;
+    int pending;            /* unfinished children, plus one for itself */
+    short rmdir;            /* directory emptied, remove it at the end */
+    void (*run) (struct mtask *);
+    void (*fini) (struct mtask *);
+    FILE *fp;               /* current verbose output segment */
+    oseg *head, *tail;
+} mtask;
+
+/* a directory entry read ahead, along with its batched request result */
+typedef struct
+{
+    int res;
+    unsigned char type;     /* d_type of the entry */
+    struct statx stx;
+    char name[NAME_MAX + 1];
+} dentry;
 
-/* operation mode */
-enum op_mode { INTERACTIVE = 1, RESTORE = 2, DELETE = 4, VERBOSE = 8 };
+static mtask * task_spawn (mtask *, mctx *, int, char *, struct stat *,
+                           void (*) (mtask *), void (*) (mtask *));
+static void task_move (mtask *);
+static void task_move_done (mtask *);
+static void async_run (int);
 
 
 void
@@ -47,11 +130,41 @@ printh (void)
 {
     usage ();
     printf ("\nOptions: \n");
+    printf ("%-17s %s", "     --async", "copy across file systems in the");
+    printf ("%s\n", " background");
     printf ("%-17s %s\n", "  -d --delete", "delete files from trash");
+    printf ("%-17s %s", "     --daemon", "run as ptrashd, serve the requests");
+    printf ("%s\n", " of ptrash");
+    printf ("%-17s %s", "     --direct", "copy large files past the page");
+    printf ("%s\n", " cache, with O_DIRECT");
+    printf ("%-17s %s\n", "     --du", "show disk usage of trash, -v per file");
+    printf ("%-17s %s\n", "     --empty", "delete all files from trash");
+    printf ("%-17s %s", "     --from-file=F", "read the files one per line from");
+    printf ("%s\n", " F, - for stdin");
+    printf ("%-17s %s", "     --home-trash", "move files of all mounts to the");
+    printf ("%s\n", " home trash");
     printf ("%-17s %s", "  -i", "interactive, confirm before over writing");
     printf ("%s\n", " or deleting a file");
+    printf ("%-17s %s\n", "  -j --jobs=N", "move directories with N threads");
+    printf ("%-17s %s", "     --list[=FMT]", "list trash as text, json or");
+    printf ("%s\n", " nul separated fields");
+    printf ("%-17s %s\n", "     --max-age=N", "evict files older than N days");
+    printf ("%-17s %s\n", "     --max-size=N", "evict oldest files over N bytes");
+    printf ("%-17s %s", "  -0 --null", "paths of --from-file end with NUL,");
+    printf ("%s\n", " stdin by default");
+    printf ("%-17s %s\n", "     --purge", "evict files over the limits now");
+    printf ("%-17s %s", "     --schedule=S", "take directory entries in inode or");
+    printf ("%s\n", " extent order, for hard disks");
+    printf ("%-17s %s\n", "     --sort=KEY", "sort --list by date, size or path");
+    printf ("%-17s %s", "     --stats[=FMT]", "print counts and timings of the");
+    printf ("%s\n", " run as text or json");
+    printf ("%-17s %s\n", "     --status", "show the moves journaled in trash");
+    printf ("%-17s %s", "     --sync=MODE", "flush trash info records: none,");
+    printf ("%s\n", " batch or full");
     printf ("%-17s %s", "  -r --restore", "restore a file from trash to");
     printf ("%s\n", " its original location");
+    printf ("%-17s %s", "     --resume", "take up the moves of runs that");
+    printf ("%s\n", " stopped before they were done");
 
     printf ("\n");
     printf ("%-17s %s\n", "  -h --help", "shows this help");
@@ -61,34 +174,136 @@ printh (void)
 }
 
 
+/*
+ * get_limit: parse a --max-size or --max-age value; a number followed by an
+ * optional unit, one of the characters of @units, worth the corresponding
+ * entry of @mult. A number alone is in units of @mult[0]. Returns -2 if the
+ * value is not valid, or too large to count in seconds or bytes.
+ */
+static long long
+get_limit (const char *val, const char *units, const long long *mult)
+{
+    char *e = NULL, *u = NULL;
+    long long n = 0, m = mult[0];
+
+    errno = 0;
+    n = strtoll (val, &e, 10);
+    if (e == val || n < 0 || errno == ERANGE)
+        return -2;
+    if (*e && (e[1] || (u = strchr (units, tolower (*e))) == NULL))
+        return -2;
+    if (u != NULL)
+        m = mult[u - units];
+
+    return n > LLONG_MAX / m ? -2 : n * m;
+}
+
+
 /* check_option: checks command line option and takes appropriate action */
 int
 check_option (int argc, char *argv[])
 {
     int n = 0, ind = 0;
-    const char optstr[] = "+dhirvV";
+    const char optstr[] = "+0dhij:rvV";
 
     struct option optlst[] = \
     {
+        { "async",   0, NULL, 'a' },
         { "delete",  0, NULL, 'd' },
+        { "direct",  0, NULL, 'D' },
+        { "du",      0, NULL, 'u' },
+        { "empty",   0, NULL, 'E' },
+        { "from-file", 1, NULL, 'F' },
         { "help",    0, NULL, 'h' },
+        { "home-trash", 0, NULL, 'H' },
+        { "jobs",    1, NULL, 'j' },
+        { "list",    2, NULL, 'l' },
+        { "max-age", 1, NULL, 'A' },
+        { "max-size", 1, NULL, 'Z' },
+        { "null",    0, NULL, '0' },
+        { "purge",   0, NULL, 'P' },
         { "restore", 0, NULL, 'r' },
+        { "resume",  0, NULL, 'R' },
+        { "schedule", 1, NULL, 'O' },
+        { "sort",    1, NULL, 's' },
+        { "stats",   2, NULL, 'T' },
+        { "status",  0, NULL, 'Q' },
+        { "sync",    1, NULL, 'S' },
         { "verbose", 0, NULL, 'v' },
         { "version", 0, NULL, 'V' },
         { 0, 0, 0, 0 }
     };
 
+    const long long smul[] = { 1, 1LL << 10, 1LL << 20, 1LL << 30, 1LL << 40 };
+    const long long amul[] = { 86400, 1, 60, 3600, 86400, 7 * 86400 };
+
     mode = opterr = 0;
     while ((n = getopt_long (argc, argv, optstr, optlst, &ind)) != -1)
     {
         switch (n)
         {
         case 'd':
-            if (mode & RESTORE)
+            if (mode & (RESTORE | LIST | USAGE))
                 goto invopt;
             mode |= DELETE;
             break;
 
+        case 'a':
+            mode |= ASYNC;
+            break;
+
+        case 'D':
+            cdirect = 1;
+            break;
+
+        case 'H':
+            htrash = 1;
+            break;
+
+        case 'Q':
+            if (mode & (DELETE | RESTORE | LIST | USAGE | PURGE))
+                goto invopt;
+            mode |= STATUS;
+            break;
+
+        case 'F':
+            pfile = optarg;
+            break;
+
+        case '0':
+            pdelim = '\0';
+            if (pfile == NULL)
+                pfile = "-";
+            break;
+
+        case 'E':
+            if (mode & (RESTORE | LIST | USAGE))
+                goto invopt;
+            mode |= DELETE | EMPTY;
+            break;
+
+        case 'A':
+            if ((qage = get_limit (optarg, " smhdw", amul)) == -2)
+                goto invopt;
+            break;
+
+        case 'Z':
+            if ((qsize = get_limit (optarg, "bkmgt", smul)) == -2)
+                goto invopt;
+            break;
+
+        case 'P':
+            if (mode & (RESTORE | LIST | USAGE))
+                goto invopt;
+            mode |= PURGE;
+            break;
+
+        case 'u':
+            if (mode & (DELETE | RESTORE | LIST | PURGE))
+                goto invopt;
+            mode |= USAGE;
+            break;
+
         case 'h':
             printh ();
             exit (0);
@@ -97,12 +312,79 @@ check_option (int argc, char *argv[])
             mode |= INTERACTIVE;
             break;
 
+        case 'j':
+            if ((jobs = atoi (optarg)) < 1)
+                goto invopt;
+            break;
+
+        case 'l':
+            if (mode & (DELETE | RESTORE | USAGE | PURGE))
+                goto invopt;
+            mode |= LIST;
+            if (optarg == NULL || !strcmp (optarg, "text"))
+                lfmt = LIST_TEXT;
+            else if (!strcmp (optarg, "json"))
+                lfmt = LIST_JSON;
+            else if (!strcmp (optarg, "nul"))
+                lfmt = LIST_NUL;
+            else
+                goto invopt;
+            break;
+
         case 'r':
-            if (mode & DELETE)
+            if (mode & (DELETE | EMPTY | LIST | USAGE | PURGE))
                 goto invopt;
             mode |= RESTORE;
             break;
 
+        case 'R':
+            if (mode & (DELETE | RESTORE | LIST | USAGE | PURGE | STATUS))
+                goto invopt;
+            mode |= RESUME;
+            break;
+
+        case 's':
+            if (!strcmp (optarg, "date"))
+                lkey = SORT_DATE;
+            else if (!strcmp (optarg, "size"))
+                lkey = SORT_SIZE;
+            else if (!strcmp (optarg, "path"))
+                lkey = SORT_PATH;
+            else
+                goto invopt;
+            break;
+
+        case 'O':
+            if (!strcmp (optarg, "none"))
+                sched = SCHED_NONE;
+            else if (!strcmp (optarg, "inode"))
+                sched = SCHED_INODE;
+            else if (!strcmp (optarg, "extent"))
+                sched = SCHED_EXTENT;
+            else
+                goto invopt;
+            break;
+
+        case 'T':
+            if (optarg == NULL || !strcmp (optarg, "text"))
+                sfmt = STATS_TEXT;
+            else if (!strcmp (optarg, "json"))
+                sfmt = STATS_JSON;
+            else
+                goto invopt;
+            break;
+
+        case 'S':
+            if (!strcmp (optarg, "none"))
+                tsync = SYNC_NONE;
+            else if (!strcmp (optarg, "batch"))
+                tsync = SYNC_BATCH;
+            else if (!strcmp (optarg, "full"))
+                tsync = SYNC_FULL;
+            else
+                goto invopt;
+            break;
+
         case 'v':
             mode |= VERBOSE;
             break;
@@ -121,9 +403,14 @@ invopt: default:
 }
 
 
-/* path: absolute path of the directory to be created */
+/*
+ * create_dir: create a directory, it is not an error if it exists already.
+ *
+ * path: absolute path of the directory to be created
+ * perm: permission bits of the new directory
+ */
 int
-create_dir (const char *path)
+create_dir (const char *path, short perm)
 {
     int ret = 0;
 
@@ -168,43 +455,67 @@ build_path (const char *dir, const char *file)
 
 
 /*
- * dst_path: build a destination path for the file to be moved.
+ * dst_path: build a destination path for the file to be moved, relative to
+ * ctx->dfd. That is the name of the file, or its original path when it is
+ * restored. The path is built in the arena of the thread.
  *
- * spath: absolute path of the source file.
+ * ctx: context of the move operation.
+ * spath: path of the source file, relative to ctx->sfd.
  */
 char *
-dst_path (const char *spath)
+dst_path (mctx *ctx, const char *spath)
 {
-    char *fp = NULL;
+    char *fp = NULL, *p = NULL;
 
-    assert (spath != NULL);
+    assert (ctx != NULL && spath != NULL);
 
-    if ((mode & RESTORE) && (!RESTORE_DIR))
+    if ((mode & RESTORE) && !ctx->depth)
     {
-        if ((fp = t_search (spath)) == NULL)
+        if ((p = t_search (spath)) == NULL)
             errx (-1, "could not retrieve restore path of `%s'", spath);
+        fp = arena_strdup (p);
+        free (p);
     }
     else
-        fp = build_path (pdir, basename (spath));
+        fp = arena_strdup (basename (spath));
 
     return fp;
 }
 
 
+/*
+ * msg_path: build the path of a file for messages, in the arena of the
+ * thread. Files are opened relative to the descriptor of their directory,
+ * full paths are built only to be printed.
+ *
+ * ctx: context of the operation.
+ * file: path of the file, relative to ctx->sfd.
+ */
+char *
+msg_path (mctx *ctx, const char *file)
+{
+    assert (ctx != NULL && file != NULL);
+
+    return ctx->sdir != NULL ? arena_path (ctx->sdir, file)
+                             : arena_strdup (file);
+}
+
+
 /*
  * open_src_file: opens the source file which is to be trashed.
  *
- * file: absolute path of the file to be trashed
+ * ctx: context of the move operation.
+ * file: path of the file to be trashed, relative to ctx->sfd.
  */
 int
-open_src_file (char *file)
+open_src_file (mctx *ctx, char *file)
 {
     int fd = -1;
 
-    assert (file != NULL);
+    assert (ctx != NULL && file != NULL);
 
-    if ((fd = open (file, O_RDONLY)) < 0)
-        warn ("could not open file `%s'", file);
+    if ((fd = openat (ctx->sfd, file, O_RDONLY|O_NOFOLLOW|O_CLOEXEC)) < 0)
+        warn ("could not open file `%s'", msg_path (ctx, file));
 
     return fd;
 }
@@ -214,33 +525,33 @@ open_src_file (char *file)
  * open_dst_file: open the destination file under '$XDG_DATA_HOME/Trash'
  * directory.
  *
- * file: absolute path of the file to open or create.
+ * ctx: context of the move operation.
+ * file: path of the source file, relative to ctx->sfd.
  */
 int
-open_dst_file (char *file)
+open_dst_file (mctx *ctx, char *file)
 {
     int fd = -1;
 
-    assert (file != NULL);
+    assert (ctx != NULL && file != NULL);
 
-    OVER_WRITE = 0;    /* do not over write */
-    if((file = dst_path (file)) != NULL)
+    if((file = dst_path (ctx, file)) != NULL)
     {
-        fd = open (file, O_CREAT|O_EXCL|O_WRONLY, perm);
+        fd = openat (ctx->dfd, file, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC,
+                     ctx->perm);
         if (fd < 0)
         {
             if (errno == EEXIST)
             {
                 if (mode & INTERACTIVE  &&  !get_choice (file, "overwrite"))
-                        return fd;
+                    return fd;
 
-                OVER_WRITE = 1;    /* over write file */
-                fd = open (file, O_CREAT|O_WRONLY|O_TRUNC, perm);
+                fd = openat (ctx->dfd, file, O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC,
+                             ctx->perm);
                 if (fd < 0)
                     warn ("could not open file `%s'", file);
             }
         }
-        free (file);
     }
 
     return fd;
@@ -257,10 +568,13 @@ get_choice (char *file, const char *prompt)
     char c = '0';
     short ret = 0;      /* negative choice */
 
+    st_hold (stdout);
     printf ("%s: %s `%s'?", prog, prompt, basename (file));
     printf (" [y/n]: ");
+    fflush (stdout);
     scanf ("%c", &c);
     getchar ();
+    st_release (stdout);
     if ((c == 'Y') || (c == 'y'))
         ret = 1;    /* positive choice */
 
@@ -272,64 +586,270 @@ get_choice (char *file, const char *prompt)
  * update_tdb: add/remove an entry of the file(last moved) to/from Trash
  * database under Trash/info directory.
  *
+ * ctx: context of the operation.
  * path: absolute path of the file last moved by move
  */
 int
-update_tdb (char *path)
+update_tdb (mctx *ctx, char *path)
 {
-    assert (path != NULL);
+    assert (ctx != NULL && path != NULL);
 
+    st_begin (PH_RECORD);
     if ((mode & RESTORE) || (mode & DELETE))
         t_delete (path);
+    else if (aworker || (ctx->job != NULL && t_exists (path)))
+    {    /* the record was written by move_async, or a run that stopped */
+        t_setsize (path, ctx->usage ? *ctx->usage : -1);
+    }
     else
-        t_insert (path);
+        t_insert (path, ctx->usage ? *ctx->usage : -1);
+    st_end ();
 
     return 1;
 }
 
 
 /*
- * copy_file: copy source file to destination file.
+ * find_trashed: returns the path in trash of the file @name, named by its
+ * trash name or original path, and makes the trash holding it the one in
+ * use. Trashes are tried in turn, the home trash first.
+ */
+static char *
+find_trashed (const char *name)
+{
+    int i = 0;
+    trash *t = NULL;
+    char *fnm = NULL, *tnm = NULL;
+    struct stat sb;
+
+    for (i = 0; (t = trash_get (i)) != NULL; i++)
+    {
+        fnm = build_path (t->files, basename (name));
+        if (!lstat (fnm, &sb))
+        {
+            use_trash (t);
+            return fnm;
+        }
+        free (fnm);
+    }
+
+    /* argument may be the original path of a trashed file */
+    for (i = 0; strchr (name, '/') && (t = trash_get (i)) != NULL; i++)
+    {
+        use_trash (t);
+        if ((tnm = t_lookup (name)) != NULL)
+        {
+            fnm = build_path (trsh, tnm);
+            free (tnm);
+            return fnm;
+        }
+    }
+    use_trash (trash_get (0));
+
+    return build_path (trsh, basename (name));
+}
+
+
+/*
+ * move_arg: move the file @fnm, an argument, to the trash in use, with the
+ * pool of worker threads for a directory. The copy of a directory or of a
+ * large file across file systems is journaled, as are the moves of the
+ * background worker and of --resume; its job goes once the source is gone
+ * and is left to be taken up otherwise, see jobs.c.
  *
- * dst: file descriptor of destination file.
- * src: file descriptor of source file.
+ * ctx: context of the move operation.
+ * fnm: absolute path of the file
+ * sb: its lstat(2)
  */
-int
-copy_file (int dst, int src)
+static void
+move_arg (mctx *ctx, char *fnm, struct stat *sb)
 {
-    char *buff = NULL;
-    struct stat stat_buf;
-    int rcnt = 0, bcnt = 0, cnt = 0, blk = 0;
-    float slice = 0.0f, inc = 0.0f, div = 25.0f;
+    struct stat b;
+
+    if (!(mode & RESTORE)
+        && (aworker || (mode & RESUME) || (sb->st_dev != tdev
+            && (S_ISDIR (sb->st_mode) || (S_ISREG (sb->st_mode)
+                                          && sb->st_size >= PAR_FILESZ))))
+        && job_open (basename (fnm), fnm, &ctx->job) < 0)
+        return;     /* another process is moving it */
+
+    if (jobs > 1 && S_ISDIR (sb->st_mode))
+        move_par (ctx, fnm, sb);
+    else
+        move (ctx, fnm, sb);
+
+    if (ctx->job != NULL)
+        job_close (ctx->job, lstat (fnm, &b) < 0 && errno == ENOENT);
+    ctx->job = NULL;
+}
+
+
+/*
+ * trash_file: move the file @fnm to trash, or restore or delete it from
+ * trash as the mode asks. A file under the trash in use is deleted.
+ *
+ * fnm: absolute path of the file
+ * sb: its lstat(2)
+ */
+static void
+trash_file (char *fnm, struct stat *sb)
+{
+    short m = mode;
+    char *dnm = NULL;
+    trash *t = NULL;
+    long long usage = 0;
+    mctx ctx = { AT_FDCWD, -1, NULL, NULL, 0, 0, 0, stdout, NULL, &usage,
+                 NULL };
+
+#ifdef __GLIBC__
+    extern char * dirname (char *);
+#endif
+
+    if (!(mode & (RESTORE | DELETE)))
+        use_trash (t = htrash ? trash_get (0) : trash_of (fnm, sb->st_dev));
+    ctx.dfd = tfd;
+    ctx.ddir = trsh;
+    dnm = dirname (strdup (fnm));
+    if (!strcmp (trsh, dnm) && !(mode & RESTORE))
+        mode |= DELETE;
+    free (dnm);
+
+    if (mode & DELETE)
+        delete (&ctx, AT_FDCWD, fnm, S_ISDIR (sb->st_mode) ? DT_DIR : DT_UNKNOWN);
+    else if ((mode & ASYNC) && sb->st_dev != tdev
+             && !move_async (&ctx, t, fnm, sb))
+        ;   /* copied across file systems in the background */
+    else
+        move_arg (&ctx, fnm, sb);
+    mode = m;
+}
 
-    assert ((src >= 0) && (dst >= 0));
 
-    fstat (src, &stat_buf);
+/*
+ * trash_arg: move, restore or delete the file named by @arg, a path or,
+ * with -r and -d, a trash name. Returns 0, or -1 if there is no such file.
+ */
+static int
+trash_arg (char *arg)
+{
+    int r = 0, ret = 0;
+    size_t l = strlen (arg);
+    char *fnm = NULL;
+    struct stat sb;
+
+    if ((mode & RESTORE) || (mode & DELETE))
+    {
+        if (l > 1 && arg[l-1] == '/')
+            arg[l-1] = '\0';
+        fnm = find_trashed (arg);
+    }
+    else
+    {
+        fnm = calloc (pathconf (arg, _PC_PATH_MAX), sizeof (char));
+        realpath (arg, fnm);
+    }
+    st_begin (PH_STAT);
+    st_sys (1);
+    r = lstat (fnm, &sb);
+    st_end ();
+    if (!r)
+        trash_file (fnm, &sb);
+    else
+    {
+        warn ("could not locate file `%s'", arg);
+        ret = -1;
+    }
+    free (fnm);
+
+    return ret;
+}
+
+
+/*
+ * trash_list: move, restore or delete the files listed in @file, "-" for
+ * the standard input. Files to be moved are taken grouped by device and
+ * parent directory, see pathlist.c. Returns 0, or -1 if a file could not
+ * be found.
+ */
+static int
+trash_list (const char *file)
+{
+    int r = 0, ret = 0;
+    size_t i = 0;
+    char *fnm = NULL;
+    plist *pl = NULL;
+    struct stat sb;
+
+    if ((pl = pl_read (file, pdelim)) == NULL)
+        return -1;
+    if (mode & (RESTORE | DELETE))
+    {    /* names in trash, taken as they come */
+        for (i = 0; i < pl_size (pl); i++)
+            if (trash_arg (pl_path (pl, i)) < 0)
+                ret = -1;
+        pl_free (pl);
+        return ret;
+    }
+
+    pl_sort (pl);
+    while ((r = pl_next (pl, &fnm, &sb)) != 0)
+    {
+        if (r < 0)
+            ret = -1;
+        else
+            trash_file (fnm, &sb);
+    }
+    pl_free (pl);
+
+    return ret;
+}
+
+
+/*
+ * resume_job: take up the move of @path to the trash entry @name, left in
+ * the journal by a run that stopped. Journaled moves copy to the home
+ * trash, that of the journal, so it is taken up there. If the source is
+ * gone, its copy is whole and only its trash info record may be missing.
+ */
+static void
+resume_job (const char *name, const char *path)
+{
+    int i = 0;
+    short h = htrash;
+    char *fnm = NULL, *p = strdup (path);
+    trash *t = NULL;
+    struct stat sb;
+
+    if (p == NULL)
+        err (-1, "could not allocate memory");
     if (mode & VERBOSE)
-        slice = (stat_buf.st_size / div);
-    blk = stat_buf.st_blksize;
-    buff = calloc (blk, sizeof (char));
-    while ((rcnt = read (src, buff, blk)) > 0)
+        st_printf (stdout, "resuming: %s\n", p);
+    if (!lstat (p, &sb))
     {
-        if (write (dst, buff, rcnt) < 0)
-            return -1;    /* copy error */
+        htrash = 1;
+        trash_file (p, &sb);
+        htrash = h;
+        free (p);
+        return;
+    }
 
-        bcnt += rcnt;
-        if (mode & VERBOSE)
+    for (i = 0; (t = trash_get (i)) != NULL; i++)
+    {
+        fnm = build_path (t->files, name);
+        if (!lstat (fnm, &sb))
         {
-            while ((bcnt > inc) && (cnt < div))
-            {
-                printf("%c%s", '\b', "=>");
-                inc += slice;
-                cnt++;
-            }
-            fflush (stdout);
+            use_trash (t);
+            if (!t_exists (p))
+                t_insert (p, -1);
+            free (fnm);
+            break;
         }
-        memset (buff, '\0', blk);
+        free (fnm);
     }
-    free (buff);
-
-    return 1;
+    if (t == NULL)
+        warnx ("nothing of `%s' is left to move", p);
+    job_done (name);
+    free (p);
 }
 
 
@@ -337,75 +857,108 @@ copy_file (int dst, int src)
 int
 main (int argc, char *argv[])
 {
-    int n = 0, l = 0;
-    struct stat stat_buf;
-
-#ifdef __GLIBC__
-    extern char * dirname (char *);
-#endif
+    int n = 0, ajobs = 1, ret = 0;
+    trash *t = NULL;
+    struct rlimit rl;
 
     prog = argv[0];
+    if (!strcmp (basename (prog), "ptrashd")
+        || (argc > 1 && !strcmp (argv[1], "--daemon")))
+    {    /* returns in the child forked for each request */
+        if (d_serve (&argc, &argv) < 0)
+            return -1;
+        prog = argv[0];
+    }
+    else if (!d_client (argc, argv, &n))
+        return n;
+    tstart = time (NULL);
     n = check_option (argc, argv);
     argc -= n;
     argv += n;
 
-    if (argc == 0)
+    if (argc == 0 && pfile == NULL
+        && !(mode & (EMPTY | LIST | USAGE | PURGE | STATUS | RESUME)))
     {
         usage ();
         return -1;
     }
     if (init_move () == -1)
         return -1;
-
-    n = 0;
-    while (n < argc)
+    if (mode & STATUS)
+        return job_status () < 0 ? -1 : 0;
+    if (mode & (RESTORE | DELETE | EMPTY | LIST | USAGE | PURGE | RESUME))
+        trash_scan ();      /* files may be in the trash of any mount */
+    if (mode & (LIST | USAGE))
+    {
+        for (n = 0; (t = trash_get (n)) != NULL; n++)
+            use_trash (t);
+        if (mode & LIST)
+            return t_list (lkey, lfmt) < 0 ? -1 : 0;
+        return t_du () < 0 ? -1 : 0;
+    }
+    if ((mode & INTERACTIVE) && pfile != NULL && !strcmp (pfile, "-"))
+        errx (-1, "-i reads answers from the standard input, not paths");
+    if (mode & (INTERACTIVE | RESTORE | DELETE | RESUME))
+        mode &= ~ASYNC;
+    if (mode & INTERACTIVE)
+        jobs = 1;       /* prompts need a single thread */
+    if (jobs > 1 && !getrlimit (RLIMIT_NOFILE, &rl))
+    {    /* directories stay open while the workers move their entries */
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &rl);
+    }
+    if (mode & ASYNC)
+    {    /* the pool is started by the background worker */
+        ajobs = jobs;
+        jobs = 1;
+    }
+    if (jobs > 1 && pool_init (jobs) == -1)
+        return -1;
+    if (sfmt == STATS_NONE && (mode & VERBOSE)
+        && !(mode & (DELETE | EMPTY | PURGE)))
+        sfmt = STATS_TEXT;  /* totals of the moves */
+    if (sfmt != STATS_NONE)
+        st_init (mode & VERBOSE);
+    for (n = 0; (mode & EMPTY) && (t = trash_get (n)) != NULL; n++)
     {
-        char *fnm = NULL;
-        long pmax = pathconf (argv[n], _PC_PATH_MAX);
+        mctx ctx = { AT_FDCWD, -1, NULL, NULL, 0, -1, 0, stdout, NULL, NULL,
+                     NULL };
 
-        pdir = trsh;
-        OVER_WRITE = RESTORE_DIR = MOVE_DIR = DELETE_DIR = 0;
-        if ((mode & RESTORE) || (mode & DELETE))
-        {
-            l = strlen (argv[n]);
-            if (argv[n][l-1] == '/')
-                argv[n][l-1] = '\0';
-            fnm = build_path (trsh, basename (argv[n]));
-        }
-        else
-        {
-            fnm = calloc (pmax, sizeof (char));
-            realpath (argv[n], fnm);
-        }
-        if (lstat (fnm, &stat_buf) == 0)
-        {
-            /*
-             * If a file is under '$XDG_DATA_HOME/Trash' and
-             * restore(-r) is NOT used, delete it.
-             */
-            char *dnm = strdup (fnm);
-
-            dnm = dirname (dnm);
-            if (!strcmp (trsh, dnm) && !(mode & RESTORE))
-                mode |= DELETE;
-            free (dnm);
-
-            if (mode & DELETE)
-                delete (fnm, &stat_buf);
-            else
-                move (fnm, &stat_buf);
-        }
-        else
-            err (-1, "could not locate file `%s'", argv[n]);
+        use_trash (t);
+        ctx.dfd = tfd;
+        ctx.ddir = trsh;
+        empty_trash (&ctx);
+    }
+    if ((mode & PURGE) && qsize < 0 && qage < 0)
+        errx (-1, "--purge needs --max-size or --max-age");
 
-        free (fnm);
-        n++;
+    if (mode & RESUME)
+        job_resume (resume_job);
+    for (n = 0; n < argc; n++)
+        if (trash_arg (argv[n]) < 0)
+            ret = -1;
+    if (pfile != NULL && trash_list (pfile) < 0)
+        ret = -1;
+    async_run (ajobs);
+    for (n = 0; (qsize >= 0 || qage >= 0) && !(mode & RESTORE)
+                && (t = trash_get (n)) != NULL; n++)
+    {
+        mctx ctx = { AT_FDCWD, -1, NULL, NULL, 0, 0, 0, stdout, NULL, NULL,
+                     NULL };
+
+        use_trash (t);
+        ctx.dfd = tfd;
+        ctx.ddir = trsh;
+        purge_trash (&ctx);
     }
-    free (trsh);
-    free (tdb);
+    pool_fini ();
+    t_dirsizes ();
+    t_sync ();
+    job_fini ();
+    st_fini (stderr, sfmt);
     umask (omask);
 
-    return 0;
+    return ret;
 }
 
 
@@ -413,78 +966,168 @@ main (int argc, char *argv[])
 int
 init_move (void)
 {
-    char *t = NULL;
+    char *t = NULL, *data = NULL, *root = NULL, *files = NULL, *info = NULL;
     short msk = 0000;
+    struct stat buf;
     struct passwd *pw = NULL;
+    trash *tr = NULL;
 
+    if ((tr = trash_get (0)) != NULL)
+    {    /* set up by ptrashd already */
+        use_trash (tr);
+        omask = umask (msk);
+        return 1;
+    }
     if ((t = getenv ("XDG_DATA_HOME")))
-        trsh = t;
+        data = strdup (t);
     else
     {
         pw = getpwuid (getuid ());
-        trsh = build_path (pw->pw_dir, ".local/share");
+        data = build_path (pw->pw_dir, ".local/share");
     }
 
-    trsh = build_path (trsh, "Trash");
-    perm = S_IRWXU;
-    if (create_dir (trsh) == -1)
+    root = build_path (data, "Trash");
+    if (create_dir (root, S_IRWXU) == -1)
+    {
+        warnx ("initialisation error");
+        return -1;
+    }
+    files = build_path (root, "files");
+    info = build_path (root, "info/");
+    free (root);
+    if ((create_dir (files, S_IRWXU) == -1) || (create_dir (info, S_IRWXU) == -1))
     {
         warnx ("initialisation error");
         return -1;
     }
-    trsh = build_path (trsh, "files");
-    tdb  = build_path (trsh, "../info/");
-    if ((create_dir (trsh) == -1) || (create_dir (tdb) == -1))
+    buf.st_dev = 0;
+    stat (files, &buf);
+    if ((tr = trash_add (files, info, data, buf.st_dev)) == NULL)
     {
         warnx ("initialisation error");
         return -1;
     }
-    pdir = trsh;
+    use_trash (tr);
     omask = umask (msk);
 
     return 1;
 }
 
 
+/*
+ * use_trash: make @t the trash files are moved to, restored and deleted
+ * from. It is switched between command line arguments only, when the
+ * worker threads are idle.
+ */
+void
+use_trash (trash *t)
+{
+    assert (t != NULL);
+
+    if (t->fd < 0
+        && (t->fd = open (t->files, O_PATH|O_DIRECTORY|O_CLOEXEC)) < 0)
+        err (-1, "could not open directory `%s'", t->files);
+    trsh = t->files;
+    tfd = t->fd;
+    tdev = t->dev;
+    t_use (t->info, t->top);
+}
+
+
+/*
+ * add_usage: account @n bytes to the disk usage of the argument being moved
+ * to trash.
+ */
+static void
+add_usage (mctx *ctx, long long n)
+{
+    if (ctx->usage != NULL && !(mode & RESTORE))
+        __atomic_add_fetch (ctx->usage, n, __ATOMIC_RELAXED);
+}
+
+
 /*
  * move: checks the file type and calls the appropriate move_<file type>
  * function to move that file to $XDG_DATA_HOME/Trash.
  *
- * file: absolute path of the file to be trashed.
+ * ctx: context of the move operation.
+ * file: path of the file to be trashed, relative to ctx->sfd; an absolute
+ * path for a command line argument.
  * stat_buf: pointer pointing to stat structure of file.
  */
 int
-move (char *file, struct stat *stat_buf)
+move (mctx *ctx, char *file, struct stat *stat_buf)
 {
     short flag = 0;
-    perm = stat_buf->st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+    amark m = arena_mark ();    /* strings of the file go when it is done */
+    mode_t t = stat_buf->st_mode;
+    ctx->perm = stat_buf->st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+
+    /* met by type once, be it renamed or copied */
+    st_add (S_ISDIR (t) ? ST_T_DIR : S_ISREG (t) ? ST_T_REG
+            : S_ISFIFO (t) ? ST_T_FIFO : S_ISCHR (t) || S_ISBLK (t) ? ST_T_NOD
+            : ST_T_OTHER, 1);
+    if ((flag = move_rename (ctx, file, stat_buf)) >= 0)
+    {    /* file: renamed or skipped, nothing to copy */
+        if (!flag)
+        {
+            st_add (ST_RENAMES, 1);
+            st_add (S_ISDIR (t) ? ST_DIRS : ST_FILES, 1);
+        }
+        if (!flag && !ctx->depth)
+        {
+            if (ctx->usage != NULL)     /* a tree is not walked to count */
+                *ctx->usage = S_ISDIR (stat_buf->st_mode) ? -1
+                              : stat_buf->st_blocks * 512LL;
+            update_tdb (ctx, file);
+        }
+        arena_release (m);
+        return 0;
+    }
 
+    flag = 0;
     if (S_ISDIR (stat_buf->st_mode))
     {    /* file: is directory     */
-        MOVE_DIR++;
-        if (mode & RESTORE)
-            RESTORE_DIR++;
-        if (!move_dir (file))
+        if (!move_dir (ctx, file))
         {
-            if (!--MOVE_DIR)
-                update_tdb (file);
-            rmdir (file);
+            st_add (ST_DIRS, 1);
+            if (ctx->task)
+                ctx->task->rmdir = 1;   /* once its children are done */
+            else
+                move_dir_done (ctx, file);
         }
-        RESTORE_DIR--;
     }
     else if (S_ISREG (stat_buf->st_mode))
     {    /* file: is regular     */
-        if (!move_reg (file))
+        if (!ctx->depth)
+            st_add (ST_SEEN, stat_buf->st_size);    /* found by move_dir */
+        if (!move_link (ctx, file, stat_buf))
+        {
+            st_add (ST_SEEN, -stat_buf->st_size);   /* nothing to copy */
+            st_add (ST_LINKS, 1);
+            flag = 1;
+        }
+        else if (!move_reg (ctx, file))
+        {
+            st_add (ST_COPIES, 1);
             flag = 1;
+            if (stat_buf->st_nlink > 1)
+            {    /* its other links are made to this copy */
+                char *fp = dst_path (ctx, file);
+
+                hl_add (stat_buf, fp[0] == '/' ? fp
+                                  : arena_path (ctx->ddir, fp));
+            }
+        }
     }
     else if (S_ISFIFO (stat_buf->st_mode))
     {    /* file: is fifo     */
-        if (!move_fifo (file))
+        if (!move_fifo (ctx, file))
             flag = 1;
     }
     else if (S_ISCHR (stat_buf->st_mode) || S_ISBLK (stat_buf->st_mode))
     {    /* file: is character/block special device file    */
-        if (!move_nod (file))
+        if (!move_nod (ctx, file))
             flag = 1;
     }
     else
@@ -492,131 +1135,689 @@ move (char *file, struct stat *stat_buf)
 
     if (flag)
     {
-        if (!MOVE_DIR)
-            update_tdb (file);
-        remove (file);
+        st_add (ST_FILES, 1);
+        if (!ctx->depth)
+            update_tdb (ctx, file);
+        st_begin (PH_REMOVE);
+        unlinkat (ctx->sfd, file, 0);
+        st_sys (1);
+        st_end ();
     }
-    perm = 0000;
+    arena_release (m);
 
     return 0;
 }
 
 
 /*
- * move_reg: does the actual movement of regular file. Returns 0 on success
- * and -1 in case of an error.
+ * move_dir_done: removes the source directory once all of its entries have
+ * been moved to $XDG_DATA_HOME/Trash.
  *
- * fpath: absolute path of the file to be trashed.
+ * ctx: context of the move operation.
+ * dpath: path of the emptied directory, relative to ctx->sfd.
  */
-int
-move_reg (char *fpath)
+void
+move_dir_done (mctx *ctx, char *dpath)
 {
-    int s = open_src_file (fpath);
-    int d = open_dst_file (fpath);
-
-    if ((s == -1) || (d == -1))
-        return -1;
-
-    if (mode & VERBOSE)
-    {
-        printf ("moving: %-25s |>", basename (fpath));
-        fflush (stdout);
-    }
-    if (copy_file (d, s) == -1)
-        return -1;
-    if (mode & VERBOSE)
-        printf ("%c%s", '\b', "|\n");
-
-    close (s);
-    close (d);
-
-    return 0;
+    assert (ctx != NULL && dpath != NULL);
+
+    if (!ctx->depth)
+        update_tdb (ctx, dpath);
+    st_begin (PH_REMOVE);
+    unlinkat (ctx->sfd, dpath, AT_REMOVEDIR);
+    st_sys (1);
+    st_end ();
 }
 
 
 /*
- * move_fifo: moves the fifo special file to $XDG_DATA_HOME/Trash.
- * Returns 0 on success and -1 in case of an error.
+ * move_rename: moves the file to its destination with a single rename(2),
+ * when the source and $XDG_DATA_HOME/Trash/files lie on the same file system.
+ * Directories are moved as a whole tree. Returns 0 on success, 1 if the user
+ * declined to over write an existing file and -1 if the file has to be copied
+ * instead.
  *
- * fpath: absolute path of the file to be moved.
+ * ctx: context of the move operation.
+ * file: path of the file to be moved, relative to ctx->sfd.
+ * stat_buf: pointer to stat structure of @file.
  */
 int
-move_fifo (char *fpath)
+move_rename (mctx *ctx, char *file, struct stat *stat_buf)
 {
-    int ret = 0;
+    int ret = -1;
     char *fp = NULL;
-    struct stat stat_buf;
+    struct stat buf;
+
+    assert (ctx != NULL && file != NULL && stat_buf != NULL);
+
+    if (ctx->cross_dev || (!(mode & RESTORE) && stat_buf->st_dev != tdev))
+        return ret;
+
+    fp = dst_path (ctx, file);
+    st_begin (PH_RENAME);
+    st_sys (1);
+    if (!renameat2 (ctx->sfd, file, ctx->dfd, fp, RENAME_NOREPLACE))
+        ret = 0;
+    else if (errno == EXDEV)
+        ctx->cross_dev = 1;
+    else if (errno == EINVAL || errno == ENOSYS)
+    {    /* file system does not support RENAME_NOREPLACE */
+        if (fstatat (ctx->dfd, fp, &buf, AT_SYMLINK_NOFOLLOW) < 0
+            && errno == ENOENT && !renameat (ctx->sfd, file, ctx->dfd, fp))
+            ret = 0;
+    }
+    else if (errno == EEXIST && !S_ISDIR (stat_buf->st_mode))
+    {
+        if ((mode & INTERACTIVE) && !get_choice (fp, "overwrite"))
+            ret = 1;
+        else if (!renameat (ctx->sfd, file, ctx->dfd, fp))
+            ret = 0;
+    }
+    st_end ();
+    if (!ret && (mode & VERBOSE))
+        st_printf (ctx->out, "renaming: %s\n", basename (file));
+
+    return ret;
+}
 
-    assert (fpath != NULL);
 
-    lstat (fpath, &stat_buf);
-    fp = dst_path (fpath);
+/*
+ * move_reg: does the actual movement of regular file. Returns 0 on success
+ * and -1 in case of an error.
+ *
+ * ctx: context of the move operation.
+ * fpath: path of the file to be trashed, relative to ctx->sfd.
+ */
+int
+move_reg (mctx *ctx, char *fpath)
+{
+    const char *eng = NULL;
+    int r = 0, d = -1;
+    off_t off = 0;
+    struct stat sb;
+    int s = open_src_file (ctx, fpath);
+
+    if (s >= 0 && ctx->job != NULL && (off = job_offset (ctx->job, s)) > 0
+        && (d = openat (ctx->dfd, dst_path (ctx, fpath),
+                        O_WRONLY|O_NOFOLLOW|O_CLOEXEC)) < 0)
+        off = 0;    /* its copy is gone, done afresh */
+    if (s >= 0 && d < 0)
+        d = open_dst_file (ctx, fpath);
 
+    if ((s == -1) || (d == -1))
+    {
+        if (s >= 0)
+            close (s);
+        return -1;
+    }
+
+    st_begin (PH_COPY);
+    r = copy_file (ctx, d, s, off, &eng);
+    st_end ();
+    if (r == -1)
+    {
+        close (s);
+        close (d);
+        return -1;
+    }
     if (mode & VERBOSE)
+        st_printf (ctx->out, "moving: %-25s %s\n", basename (fpath), eng);
+    if (!fstat (d, &sb))
+        add_usage (ctx, sb.st_blocks * 512LL);
+
+    close (s);
+    close (d);
+
+    return 0;
+}
+
+
+/*
+ * move_link: makes a file a hard link to the copy of another of its links,
+ * when one was moved to $XDG_DATA_HOME/Trash earlier. Its link count is not
+ * looked at, as the links moved before it are gone from the source. Returns
+ * 0 on success and -1 if the file is to be copied.
+ *
+ * ctx: context of the move operation.
+ * fpath: path of the file to be trashed, relative to ctx->sfd.
+ * stat_buf: pointer to stat structure of @fpath.
+ */
+int
+move_link (mctx *ctx, char *fpath, struct stat *stat_buf)
+{
+    char *lp = NULL, *fp = NULL;
+
+    assert (ctx != NULL && fpath != NULL && stat_buf != NULL);
+
+    if ((lp = hl_find (stat_buf)) == NULL)
+        return -1;
+
+    fp = dst_path (ctx, fpath);
+    if (linkat (AT_FDCWD, lp, ctx->dfd, fp, 0) < 0)
+    {    /* move_reg asks before overwriting a file with -i */
+        if (errno != EEXIST || (mode & INTERACTIVE)
+            || unlinkat (ctx->dfd, fp, 0) < 0
+            || linkat (AT_FDCWD, lp, ctx->dfd, fp, 0) < 0)
+            return -1;
+    }
+    if (mode & VERBOSE)
+        st_printf (ctx->out, "linking: %s\n", basename (fpath));
+
+    return 0;
+}
+
+
+/*
+ * move_async: reserve the trash entry of a file to be copied across file
+ * systems, write its trash info record and queue its move to the
+ * background worker. The entry is made first, a directory or an empty file
+ * with the permissions of the source, and filled by the worker. Returns 0
+ * when the move is queued and -1 if it is to be done now.
+ *
+ * ctx: context of the move operation.
+ * t: trash the file is moved to.
+ * file: absolute path of the file to be trashed.
+ * stat_buf: pointer to stat structure of @file.
+ */
+int
+move_async (mctx *ctx, trash *t, char *file, struct stat *stat_buf)
+{
+    int fd = -1;
+    char *fp = NULL;
+    ajob *q = NULL;
+    amark m = arena_mark ();
+
+    assert (ctx != NULL && t != NULL && file != NULL && stat_buf != NULL);
+
+    if (!S_ISDIR (stat_buf->st_mode) && !S_ISREG (stat_buf->st_mode))
+        return -1;  /* nothing to copy */
+    if ((q = realloc (aq, (naq + 1) * sizeof (ajob))) == NULL)
+        return -1;
+    aq = q;
+    q = &aq[naq];
+    if ((q->path = strdup (file)) == NULL)
+        return -1;
+
+    fp = dst_path (ctx, file);
+    if (job_add (fp, file) < 0)
+        goto err;
+    if (S_ISDIR (stat_buf->st_mode))
+        fd = mkdirat (ctx->dfd, fp, stat_buf->st_mode & 0777) < 0
+             && errno != EEXIST ? -1 : 0;
+    else if ((fd = openat (ctx->dfd, fp, O_CREAT|O_WRONLY|O_CLOEXEC,
+                           stat_buf->st_mode & 0777)) >= 0)
+        close (fd);
+    if (fd < 0)
+    {
+        warn ("could not create `%s' in trash", fp);
+        job_done (fp);
+        goto err;
+    }
+    t_insert (file, -1);
+    if (mode & VERBOSE)
+        st_printf (ctx->out, "queuing: %s\n", fp);
+
+    q->sb = *stat_buf;
+    q->trash = t;
+    naq++;
+    arena_release (m);
+    return 0;
+
+err:
+    free (q->path);
+    arena_release (m);
+    return -1;
+}
+
+
+/*
+ * async_work: move the files queued by move_async, journaling each move,
+ * see move_arg.
+ */
+static void
+async_work (void)
+{
+    int i = 0;
+
+    aworker = 1;
+    for (i = 0; i < naq; i++)
+    {
+        long long usage = 0;
+        mctx ctx = { AT_FDCWD, -1, NULL, NULL, 0, 0, 0, stdout, NULL, &usage,
+                     NULL };
+
+        use_trash (aq[i].trash);
+        ctx.dfd = tfd;
+        ctx.ddir = trsh;
+        move_arg (&ctx, aq[i].path, &aq[i].sb);
+        free (aq[i].path);
+    }
+    naq = 0;
+    aworker = 0;
+}
+
+
+/*
+ * async_run: start the background worker that moves the files queued by
+ * move_async, with @njobs threads, and return without waiting for it. The
+ * worker is detached from the session of ptrash, and writes its messages to
+ * the log of the jobs. The moves are done here if it can not be started.
+ */
+static void
+async_run (int njobs)
+{
+    int fd = -1, i = 0;
+    pid_t pid = 0;
+
+    if (!naq)
+        return;
+
+    st_fini (NULL, STATS_NONE);     /* the reporter thread is not forked */
+    fflush (NULL);
+    if ((pid = fork ()) < 0)
+    {
+        warn ("could not start the background worker");
+        async_work ();
+        return;
+    }
+    if (pid > 0)
+    {
+        waitpid (pid, NULL, 0);
+        naq = 0;
+        return;
+    }
+
+    /* the child leaves the worker as an orphan of its own session */
+    setsid ();
+    if (fork ())
+        _exit (0);
+
+    if ((fd = open ("/dev/null", O_RDWR|O_CLOEXEC)) >= 0)
+    {
+        dup2 (fd, 0);
+        dup2 (fd, 1);
+        dup2 (fd, 2);
+        close (fd);
+    }
+    if ((fd = job_log ()) >= 0)
     {
-        printf ("moving: %-25s |>", basename (fpath));
-        fflush (stdout);
+        dup2 (fd, 2);
+        close (fd);
     }
-    if ((ret = mkfifo (fp, stat_buf.st_mode)) < 0)
+    iob_put ();     /* the ring of the parent stays with it */
+    t_detach ();
+    for (i = 0; i < naq; i++)
+        job_take (basename (aq[i].path));
+
+    jobs = njobs;
+    if (jobs > 1 && pool_init (jobs) == -1)
+        jobs = 1;
+    async_work ();
+    job_fini ();
+    pool_fini ();
+    t_dirsizes ();
+    t_sync ();
+    fflush (NULL);
+    _exit (0);
+}
+
+
+/*
+ * move_fifo: moves the fifo special file to $XDG_DATA_HOME/Trash.
+ * Returns 0 on success and -1 in case of an error.
+ *
+ * ctx: context of the move operation.
+ * fpath: path of the file to be moved, relative to ctx->sfd.
+ */
+int
+move_fifo (mctx *ctx, char *fpath)
+{
+    int ret = 0;
+    char *fp = NULL;
+    struct stat stat_buf;
+
+    assert (ctx != NULL && fpath != NULL);
+
+    fstatat (ctx->sfd, fpath, &stat_buf, AT_SYMLINK_NOFOLLOW);
+    fp = dst_path (ctx, fpath);
+
+    if ((ret = mkfifoat (ctx->dfd, fp, stat_buf.st_mode)) < 0)
          err (-1, "could not create fifo file `%s'", fp);
     if (mode & VERBOSE)
-        printf ("%c%27s", '\b', "|\n");
+        st_printf (ctx->out, "moving: %s\n", basename (fpath));
 
-    free (fp);
     return ret;
 }
 
 
 /*
- * move_dir: moves a whole directory to $XDG_DATA_HOME/Trash.
+ * move_dir: moves a whole directory to $XDG_DATA_HOME/Trash. When run by a
+ * pool task, sub-directories and large files are queued as child tasks.
+ * Entries are moved relative to the descriptors of the source and the
+ * destination directories, they are not looked up by full path. Entries are
+ * read with large getdents64 calls, and only regular files, or those of an
+ * unknown d_type, are stat-ed here; the others need their type alone.
  *
- * dpath: absolute path of the directory to be trashed.
+ * ctx: context of the move operation.
+ * dpath: path of the directory to be trashed, relative to ctx->sfd.
  */
 int
-move_dir (char *dpath)
+move_dir (mctx *ctx, char *dpath)
 {
-    DIR *d = NULL;
-    struct stat buf;
-    char *lpdir = NULL;
-    struct dirent *dent = NULL;
-    static unsigned char flag = 0;
+    dents *d = NULL;
+    struct stat buf, dsb;
+    char *lpdir = NULL, *spath = NULL, *dspath = NULL;
+    int i = 0, n = 0, fd = -1, lfd = -1;
+    dentry *ents = NULL;
+    iobatch *b = iob_get ();
+    struct dirent64 *de = NULL;
+
+    assert (ctx != NULL && dpath != NULL);
+
+    lpdir = dst_path (ctx, dpath);
+    spath = msg_path (ctx, dpath);
+    dspath = lpdir[0] == '/' ? lpdir : arena_path (ctx->ddir, lpdir);
+    if (ctx->task && ((spath = strdup (spath)) == NULL
+                      || (dspath = strdup (dspath)) == NULL))
+        err (-1, "could not allocate memory");  /* outlives the arena */
+    if ((fd = openat (ctx->sfd, dpath,
+                      O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC)) < 0
+        || fstat (fd, &dsb) < 0)
+        warn ("could not open directory `%s'", spath);
+    else if (mkdirat (ctx->dfd, lpdir, ctx->perm = dsb.st_mode
+                      & (S_IRWXU | S_IRWXG | S_IRWXO)) < 0 && errno != EEXIST)
+        warn ("could not create directory `%s'", lpdir);
+    else if ((lfd = openat (ctx->dfd, lpdir,
+                            O_PATH|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC)) < 0)
+        warn ("could not open directory `%s'", lpdir);
+    if (lfd < 0)
+    {
+        if (fd >= 0)
+            close (fd);
+        if (ctx->task)
+        {
+            free (spath);
+            free (dspath);
+        }
+        return -1;
+    }
+    if (!fstat (lfd, &buf))
+        add_usage (ctx, buf.st_blocks * 512LL);
+
+    d = dents_init (fd, arena_alloc (DENTS_SZ), DENTS_SZ);
+    if (sched != SCHED_NONE)
+        dents_sort (d, sched);  /* copy in the order of the disk */
+    ents = arena_alloc (IOB_DEPTH * sizeof (dentry));
+    do
+    {    /* stat a batch of entries with one submission */
+        st_begin (PH_STAT);
+        for (n = 0; n < IOB_DEPTH && (de = dents_read (d)) != NULL; n++)
+        {
+            strcpy (ents[n].name, de->d_name);
+            ents[n].type = de->d_type;
+            ents[n].res = 0;
+            if (de->d_type == DT_REG || de->d_type == DT_UNKNOWN)
+                iob_statx (b, fd, ents[n].name, AT_SYMLINK_NOFOLLOW,
+                           STATX_BASIC_STATS, &ents[n].stx, &ents[n].res);
+        }
+        iob_submit (b);
+        st_end ();
 
-    assert (dpath != NULL);
+        for (i = 0; i < n; i++)
+        {
+            mctx c = *ctx;
+            char *p = NULL, *dnm = ents[i].name;
 
-    if ((mode & RESTORE) && (!flag))
+            if (ents[i].res < 0)
+            {
+                errno = -ents[i].res;
+                warn ("could not stat file `%s/%s'", spath, dnm);
+                continue;
+            }
+            if (ents[i].type == DT_REG || ents[i].type == DT_UNKNOWN)
+            {
+                statx_stat (&ents[i].stx, &buf);
+                if (S_ISREG (buf.st_mode))
+                    st_add (ST_SEEN, buf.st_size);
+            }
+            else
+            {    /* the rest is read by move_dir, move_fifo or move_nod */
+                memset (&buf, 0, sizeof (buf));
+                buf.st_mode = DTTOIF (ents[i].type);
+                buf.st_dev = dsb.st_dev;
+            }
+
+            c.sfd = fd;
+            c.dfd = lfd;
+            c.sdir = spath;
+            c.ddir = dspath;
+            c.depth++;
+            c.task = NULL;
+            if (ctx->task && (S_ISDIR (buf.st_mode)
+                || (S_ISREG (buf.st_mode) && buf.st_size >= PAR_FILESZ)))
+            {
+                if ((p = strdup (dnm)) == NULL)
+                    err (-1, "could not allocate memory");
+                task_spawn (ctx->task, &c, fd, p, &buf, task_move,
+                            task_move_done);
+                ctx->out = ctx->task->fp;
+                continue;
+            }
+            if (ctx->task)
+                c.out = ctx->task->fp;
+
+            move (&c, dnm, &buf);
+        }
+    } while (n == IOB_DEPTH);
+
+    if (ctx->task)
+    {    /* closed when children are done */
+        ctx->task->fd = fd;
+        ctx->task->lfd = lfd;
+        ctx->task->spath = spath;
+        ctx->task->dspath = dspath;
+    }
+    else
     {
-        lpdir = pdir = t_search (dpath);
-        if (!pdir)
-            errx (-1, "could not retrieve restore path of `%s'", dpath);
-        flag = 1;
+        close (fd);
+        close (lfd);
+    }
+
+    return 0;
+}
+
+
+/*
+ * out_open: start a new segment of verbose output for the task. Output of
+ * @child, if any, goes between the current segment and the new one.
+ */
+static void
+out_open (mtask *t, mtask *child)
+{
+    oseg *o = calloc (1, sizeof (oseg));
+
+    if (o == NULL)
+        err (-1, "could not allocate output buffer");
+    if (t->fp != NULL)
+        fclose (t->fp);
+    if (t->tail != NULL)
+    {    /* output of the child follows that of the current segment */
+        t->tail->child = child;
+        t->tail->next = o;
     }
     else
-        lpdir = pdir = build_path (pdir, basename (dpath));
+        t->head = o;
+    t->tail = o;
+
+    if ((t->fp = open_memstream (&o->buf, &o->len)) == NULL)
+        err (-1, "could not allocate output buffer");
+}
 
-    if (create_dir (pdir) == -1)
-        return -1;
 
-    d = opendir (dpath);
-    while ((dent = readdir (d)) != NULL)
+/*
+ * out_flush: write verbose output of the task and its children to stdout,
+ * in the order a serial run would have, and release the tasks.
+ */
+static void
+out_flush (mtask *t)
+{
+    oseg *o = NULL;
+
+    while ((o = t->head) != NULL)
     {
-        char *p = NULL, *dnm = dent->d_name;
+        if (o->len)
+        {
+            st_hold (stdout);
+            fwrite (o->buf, 1, o->len, stdout);
+            st_release (stdout);
+        }
+        if (o->child)
+            out_flush (o->child);
+        t->head = o->next;
+        free (o->buf);
+        free (o);
+    }
+    free (t->path);
+    free (t);
+}
 
-        p = build_path (dpath, dnm);
-        if (p == NULL)
-            break;
-        lstat (p, &buf);
-        perm = buf.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
-        if (S_ISDIR (buf.st_mode)
-            && (!strcmp (dnm, ".") || !strcmp (dnm, "..")))
-            continue;
 
-        move (p, &buf);
-        pdir = lpdir;
-        perm = 0;
-        free (p);
+/*
+ * task_done: drop a reference to the task. When the last one goes, the task
+ * is finished off, an emptied directory is removed, and the parent task is
+ * notified in turn.
+ */
+static void
+task_done (mtask *t)
+{
+    mtask *p = NULL;
+
+    while (t && !__atomic_sub_fetch (&t->pending, 1, __ATOMIC_ACQ_REL))
+    {
+        if (t->fini != NULL)
+            t->fini (t);
+
+        p = t->parent;
+        if (!(mode & VERBOSE))
+        {    /* nothing to print, release it now */
+            free (t->path);
+            free (t);
+        }
+        t = p;
     }
-    free (lpdir);
-    closedir (d);
+}
+
+
+static void
+task_move (mtask *t)
+{
+    move (&t->ctx, t->path, &t->sb);
+}
+
+
+static void
+task_move_done (mtask *t)
+{
+    if (t->fd >= 0)
+        close (t->fd);
+    if (t->lfd >= 0)
+        close (t->lfd);
+    if (t->rmdir)
+        move_dir_done (&t->ctx, t->path);
+    free (t->spath);
+    free (t->dspath);
+    t->fd = -1;
+    t->lfd = -1;
+    t->spath = t->dspath = NULL;
+}
+
+
+static void
+task_run (void *arg)
+{
+    mtask *t = arg;
+
+    t->run (t);
+    if (t->fp != NULL)
+    {
+        fclose (t->fp);
+        t->fp = NULL;
+    }
+    task_done (t);
+}
+
+
+/*
+ * task_spawn: queue a file to be handled by a pool worker. Returns the new
+ * task, which is released on completion unless verbose output is pending.
+ *
+ * parent: task of the directory holding @path, NULL for an argument.
+ * ctx: context of the operation for @path.
+ * dfd: descriptor of the directory holding @path, or AT_FDCWD.
+ * path: path of the file, owned by the task hereafter.
+ * stat_buf: pointer to stat structure of @path, or NULL.
+ * run: function doing the job.
+ * fini: function called once the task and all of its children are done.
+ */
+static mtask *
+task_spawn (mtask *parent, mctx *ctx, int dfd, char *path,
+            struct stat *stat_buf, void (*run) (mtask *), void (*fini) (mtask *))
+{
+    mtask *t = calloc (1, sizeof (mtask));
+
+    if (t == NULL)
+        err (-1, "could not allocate task for `%s'", path);
+
+    t->ctx = *ctx;
+    t->path = path;
+    if (stat_buf != NULL)
+        t->sb = *stat_buf;
+    t->pfd = dfd;
+    t->fd = t->lfd = -1;
+    t->parent = parent;
+    t->pending = 1;
+    t->run = run;
+    t->fini = fini;
+    if (parent != NULL)
+    {
+        __atomic_add_fetch (&parent->pending, 1, __ATOMIC_ACQ_REL);
+        if (mode & VERBOSE)
+            out_open (parent, t);
+    }
+    if (mode & VERBOSE)
+        out_open (t, NULL);
+    t->ctx.out = t->fp;
+    t->ctx.task = t;
+    pool_submit (task_run, t);
+
+    return t;
+}
+
+
+/*
+ * move_par: moves a whole directory to $XDG_DATA_HOME/Trash using the pool
+ * of worker threads. Verbose output is printed once the tree is done.
+ *
+ * ctx: context of the move operation.
+ * dpath: absolute path of the directory to be trashed.
+ * stat_buf: pointer to stat structure of @dpath.
+ */
+int
+move_par (mctx *ctx, char *dpath, struct stat *stat_buf)
+{
+    mtask *t = NULL;
+    char *p = strdup (dpath);
+
+    assert (ctx != NULL && dpath != NULL && stat_buf != NULL);
+
+    if (p == NULL)
+        return -1;
+
+    t = task_spawn (NULL, ctx, AT_FDCWD, p, stat_buf, task_move,
+                    task_move_done);
+    pool_wait ();
+    if (mode & VERBOSE)
+        out_flush (t);
 
     return 0;
 }
@@ -627,64 +1828,70 @@ move_dir (char *dpath)
  * $XDG_DATA_HOME/Trash. Returns 0 on success and -1 in case of an error.
  * User must be root to do this.
  *
- * npath: absolute path of the file to be moved.
+ * ctx: context of the move operation.
+ * npath: path of the file to be moved, relative to ctx->sfd.
  */
 int
-move_nod (char *npath)
+move_nod (mctx *ctx, char *npath)
 {
     int ret = 0;
     char *fp = NULL;
     struct stat stat_buf;
 
-    assert (npath != NULL);
+    assert (ctx != NULL && npath != NULL);
 
-    fp = dst_path (npath);
-    lstat (npath, &stat_buf);
-    if (mode & VERBOSE)
-    {
-        printf ("moving: %-25s |>", basename (npath));
-        fflush (stdout);
-    }
-    if ((ret = mknod (fp, stat_buf.st_mode, stat_buf.st_dev)) < 0)
+    fp = dst_path (ctx, npath);
+    fstatat (ctx->sfd, npath, &stat_buf, AT_SYMLINK_NOFOLLOW);
+    if ((ret = mknodat (ctx->dfd, fp, stat_buf.st_mode, stat_buf.st_rdev)) < 0)
         err (-1, "could not create file `%s'", basename (fp));
     if (mode & VERBOSE)
-        printf ("%c%27s", '\b', "|\n");
+        st_printf (ctx->out, "moving: %s\n", basename (npath));
 
-    free (fp);
     return ret;
 }
 
 
 /*
  * delete: deletes the named file from $XDG_DATA_HOME/Trash directory.
- * Returns 0 on success and -1 in case of error.
+ * Directories are emptied with delete_dir first, by the pool of worker
+ * threads when there is one. Returns 0 on success and -1 in case of error.
  *
+ * ctx: context of the delete operation.
+ * dfd: descriptor of the directory holding @file, or AT_FDCWD.
  * file: name of the file in trash to be deleted.
- * stat_buf: pointer to stat structure of @file.
+ * type: d_type of @file, DT_UNKNOWN when not known.
  */
 int
-delete (char *file, struct stat *stat_buf)
+delete (mctx *ctx, int dfd, char *file, unsigned char type)
 {
-    assert (file != NULL && stat_buf != NULL);
+    int r = -1;
+
+    assert (ctx != NULL && file != NULL);
 
     if ((mode & INTERACTIVE) && (!get_choice (file, "delete")))
         return -1;
     if (mode & VERBOSE)
-        printf ("removing: %s\n", basename (file));
-    if (S_ISDIR (stat_buf->st_mode))
+        st_printf (ctx->out, "removing: %s\n", basename (file));
+
+    if (type != DT_DIR)
     {
-        DELETE_DIR++;
-        if (!delete_dir (file))
-        {
-            if(!--DELETE_DIR)
-                update_tdb (file);
-            rmdir (file);
-        }
+        st_begin (PH_REMOVE);
+        st_sys (1);
+        r = unlinkat (dfd, file, 0);
+        st_end ();
+    }
+    if (!r)
+    {
+        if (!ctx->depth)
+            update_tdb (ctx, file);
     }
-    else if (!remove (file))
+    else if (type == DT_DIR || errno == EISDIR)
     {
-        if (!DELETE_DIR)
-            update_tdb (file);
+        if (jobs > 1)
+            return delete_par (ctx, dfd, file);
+        if (delete_dir (ctx, dfd, file) < 0)
+            return -1;
+        delete_dir_done (ctx, dfd, file);
     }
     else
         err (-1, "could not remove file `%s'", file);
@@ -694,35 +1901,244 @@ delete (char *file, struct stat *stat_buf)
 
 
 /*
- * delete_dir: removes directory from $XDG_DATA_HOME/Trash. On success it
- * returns 0, and returns -1 in case of an error.
+ * delete_reap: submits the batch of unlinkat requests queued by delete_dir
+ * and checks their results. Returns 0, the number of requests left queued.
+ *
+ * ctx: context of the delete operation of the directory.
+ * b: batch holding the requests.
+ * ents: entries the requests were queued for.
+ * n: number of entries.
+ */
+static int
+delete_reap (mctx *ctx, iobatch *b, dentry *ents, int n)
+{
+    int i = 0;
+
+    st_begin (PH_REMOVE);
+    iob_submit (b);
+    st_end ();
+    for (i = 0; i < n; i++)
+    {
+        if (ents[i].res < 0)
+        {
+            errno = -ents[i].res;
+            err (-1, "could not remove file `%s'", ents[i].name);
+        }
+        if (ctx->depth == -1)
+            update_tdb (ctx, ents[i].name);  /* entry of Trash/files */
+    }
+
+    return 0;
+}
+
+
+/*
+ * delete_dir: removes the contents of a directory from $XDG_DATA_HOME/Trash.
+ * On success it returns 0, and returns -1 in case of an error. Under a pool
+ * task, the directory is left open for the child tasks queued by delete.
  *
+ * ctx: context of the delete operation.
+ * dfd: descriptor of the directory holding @dpath, or AT_FDCWD.
  * dpath: path of the directory to be deleted from $XDG_DATA_HOME/Trash
  */
 int
-delete_dir (char *dpath)
+delete_dir (mctx *ctx, int dfd, char *dpath)
 {
-    DIR *d = NULL;
-    struct stat buf;
-    struct dirent *dent = NULL;
+    int fd = -1, n = 0;
+    dents *d = NULL;
+    dentry *ents = NULL;
+    iobatch *b = iob_get ();
+    struct dirent64 *dent = NULL;
+    amark m = arena_mark ();
 
-    assert (dpath != NULL);
+    assert (ctx != NULL && dpath != NULL);
 
-    d = opendir (dpath);
-    while ((dent = readdir (d)) != NULL)
+    fd = openat (dfd, dpath, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd < 0)
     {
-        char *p = NULL, *dnm = dent->d_name;
-        if ((p = build_path (dpath, dnm)) == NULL)
-            break;
-        lstat (p, &buf);
-        if (S_ISDIR (buf.st_mode) && ((strcmp (dnm, ".") == 0)
-            || (strcmp (dnm, "..") == 0)))
+        warn ("could not open directory `%s'", dpath);
+        return -1;
+    }
+    d = dents_init (fd, arena_alloc (DENTS_SZ), DENTS_SZ);
+    if (sched != SCHED_NONE)
+        dents_sort (d, SCHED_INODE);    /* data is not read, only inodes */
+    ents = arena_alloc (IOB_DEPTH * sizeof (dentry));
+
+    while ((dent = dents_read (d)) != NULL)
+    {
+        mctx c = *ctx;
+        char *dnm = dent->d_name;
+
+        c.depth++;
+        if (ctx->task)
+            c.out = ctx->task->fp;
+        if (dent->d_type == DT_DIR || dent->d_type == DT_UNKNOWN
+            || (mode & INTERACTIVE))
+        {
+            delete (&c, fd, dnm, dent->d_type);
+            if (ctx->task)
+                ctx->out = ctx->task->fp;
             continue;
+        }
 
-        delete (p, &buf);
-        free (p);
+        /* not a directory: queue its unlinkat to the batch */
+        if (mode & VERBOSE)
+            st_printf (c.out, "removing: %s\n", dnm);
+        strcpy (ents[n].name, dnm);
+        iob_unlinkat (b, fd, ents[n].name, 0, &ents[n].res);
+        if (++n == IOB_DEPTH)
+            n = delete_reap (ctx, b, ents, n);
+    }
+    delete_reap (ctx, b, ents, n);
+    arena_release (m);
+
+    if (ctx->task)
+        ctx->task->fd = fd;     /* closed when children are done */
+    else
+        close (fd);
+
+    return 0;
+}
+
+
+/*
+ * delete_dir_done: removes an emptied directory, along with its Trash/info
+ * record when it is the named file.
+ *
+ * ctx: context of the delete operation.
+ * dfd: descriptor of the directory holding @dpath, or AT_FDCWD.
+ * dpath: path of the emptied directory.
+ */
+void
+delete_dir_done (mctx *ctx, int dfd, char *dpath)
+{
+    assert (ctx != NULL && dpath != NULL);
+
+    if (ctx->depth < 0)
+        return;     /* Trash/files itself */
+    if (unlinkat (dfd, dpath, AT_REMOVEDIR) < 0)
+        warn ("could not remove directory `%s'", dpath);
+    else if (!ctx->depth)
+        update_tdb (ctx, dpath);
+}
+
+
+static void
+task_delete (mtask *t)
+{
+    if (!delete_dir (&t->ctx, t->pfd, t->path))
+        t->rmdir = 1;
+}
+
+
+static void
+task_delete_done (mtask *t)
+{
+    if (t->fd >= 0)
+        close (t->fd);
+    if (t->rmdir)
+        delete_dir_done (&t->ctx, t->pfd, t->path);
+}
+
+
+/*
+ * delete_par: queues a directory to be deleted by the pool of worker
+ * threads. At the top level it waits for the whole tree to go.
+ *
+ * ctx: context of the delete operation.
+ * dfd: descriptor of the directory holding @dpath, or AT_FDCWD.
+ * dpath: path of the directory to be deleted.
+ */
+int
+delete_par (mctx *ctx, int dfd, char *dpath)
+{
+    mtask *t = NULL;
+    mtask *parent = ctx->task;
+    char *p = strdup (dpath);
+
+    assert (ctx != NULL && dpath != NULL);
+
+    if (p == NULL)
+        return -1;
+
+    t = task_spawn (parent, ctx, dfd, p, NULL, task_delete, task_delete_done);
+    if (parent == NULL)
+    {
+        pool_wait ();
+        if (mode & VERBOSE)
+            out_flush (t);
     }
-    closedir (d);
 
     return 0;
 }
+
+
+/*
+ * purge_trash: evicts the oldest files from $XDG_DATA_HOME/Trash, along
+ * with their Trash/info records, while it is over the --max-size or
+ * --max-age limits. Files moved to trash by this run are kept. Returns the
+ * number of files evicted.
+ *
+ * ctx: context of the delete operation.
+ */
+int
+purge_trash (mctx *ctx)
+{
+    int n = 0;
+    short m = mode;
+    struct stat sb;
+    time_t since = tstart;
+    char *nm = NULL, *last = NULL, *fnm = NULL;
+
+    assert (ctx != NULL);
+
+    if (m & PURGE)
+        since = time (NULL) + 1;    /* nothing was moved in */
+    mode = (mode & ~RESTORE) | DELETE;     /* records go with the files */
+    while ((nm = t_evict (qsize, qage, since)) != NULL)
+    {
+        if (last != NULL && !strcmp (nm, last))
+        {
+            warnx ("could not evict `%s' from trash", nm);
+            free (nm);
+            break;
+        }
+        fnm = build_path (trsh, nm);
+        if (lstat (fnm, &sb) < 0)
+            t_delete (fnm);     /* record without a file */
+        else
+            delete (ctx, AT_FDCWD, fnm, S_ISDIR (sb.st_mode) ? DT_DIR
+                                                            : DT_UNKNOWN);
+        free (fnm);
+        free (last);
+        last = nm;
+        n++;
+    }
+    free (last);
+    mode = m;
+
+    return n;
+}
+
+
+/*
+ * empty_trash: deletes all the files from $XDG_DATA_HOME/Trash along with
+ * their Trash/info records. Returns 0 on success and -1 on error.
+ *
+ * ctx: context of the delete operation, at depth -1.
+ */
+int
+empty_trash (mctx *ctx)
+{
+    int ret = 0;
+
+    assert (ctx != NULL);
+
+    if (jobs > 1)
+        ret = delete_par (ctx, AT_FDCWD, trsh);
+    else
+        ret = delete_dir (ctx, AT_FDCWD, trsh);
+    t_empty ();     /* records without a file */
+
+    return ret;
+}
@@ -21,6 +21,10 @@
 #ifndef MOVE_H
 #define MOVE_H
 
+#ifdef HAVE_CONFIG_H
+    #include <config.h>
+#endif
+
 #include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +39,7 @@
 #include <getopt.h>         /* for getopt_long, etc */
 #include <dirent.h>         /* for struct DIR  */
 #include <pwd.h>            /* for struct passwd */
+#include <linux/fs.h>       /* for RENAME_NOREPLACE */
 
 #ifndef __GLIBC__
     #include <libgen.h>     /* for basename */
@@ -42,6 +47,62 @@
 
 #define BUFSZ           100
 #define VERSION         "1.1"
+#define PAR_FILESZ      (1024 * 1024)   /* files this big get their own task */
+#define IOB_DEPTH       64              /* requests per I/O batch */
+#define IOB_LINK        1               /* next request waits for this one */
+#define DENTS_SZ        (64 * 1024)     /* getdents64 buffer of a traversal */
+
+/* operation mode */
+enum op_mode { INTERACTIVE = 1, RESTORE = 2, DELETE = 4, VERBOSE = 8,
+               EMPTY = 16, LIST = 32, USAGE = 64, PURGE = 128, ASYNC = 256,
+               STATUS = 512, RESUME = 1024 };
+
+/* durability of trash info records, --sync */
+enum sync_mode { SYNC_NONE, SYNC_BATCH, SYNC_FULL };
+
+/* order of the entries of a directory, --schedule */
+enum sched_mode { SCHED_NONE, SCHED_INODE, SCHED_EXTENT };
+
+/* counters and timed phases of a run, and format of --stats, see stats.c */
+enum st_counter { ST_FILES, ST_DIRS, ST_RENAMES, ST_COPIES, ST_LINKS,
+                  ST_BYTES, ST_SEEN, ST_T_REG, ST_T_DIR, ST_T_FIFO, ST_T_NOD,
+                  ST_T_OTHER, ST_MAX };
+enum st_phase { PH_READDIR, PH_STAT, PH_RENAME, PH_COPY, PH_RECORD,
+                PH_REMOVE, PH_MAX };
+enum stats_fmt { STATS_NONE, STATS_TEXT, STATS_JSON };
+
+/* order and format of --list output */
+enum list_key { SORT_DATE, SORT_SIZE, SORT_PATH };
+enum list_fmt { LIST_TEXT, LIST_JSON, LIST_NUL };
+
+/* journal of a move across file systems, see jobs.c */
+typedef struct tjob tjob;
+
+/* state of a move operation, every pool task carries a copy of its own */
+typedef struct
+{
+    int sfd;                /* directory holding the file, or AT_FDCWD */
+    int dfd;                /* directory where the file is moved to */
+    const char *sdir;       /* path of sfd for messages, NULL at the top */
+    const char *ddir;       /* path of dfd, for links to earlier copies */
+    short perm;             /* permission bits of the file */
+    short depth;            /* 0 for a command line argument, +1 per level */
+    short cross_dev;        /* rename(2) failed with EXDEV */
+    FILE *out;              /* stream for verbose messages */
+    struct mtask *task;     /* pool task moving this directory, or NULL */
+    long long *usage;       /* bytes the argument takes in trash, or NULL */
+    tjob *job;              /* journal of the move of the argument, or NULL */
+} mctx;
+
+/* a trash directory: the home trash, or that at the top of a mount */
+typedef struct trash
+{
+    char *files;            /* directory of the trashed files */
+    char *info;             /* directory of their info records, ends in '/' */
+    char *top;              /* relative original paths are from here */
+    int fd;                 /* files directory, opened on first use */
+    dev_t dev;              /* device of the files directory */
+} trash;
 
 
 /* displays the help information for move */
@@ -51,26 +112,28 @@ extern void printh (void);
  * returns index of the first non-option command line argument or -1 on error */
 extern int check_option (int, char *[]);
 
-/* create a directory at specified path
+/* create a directory at specified path with given permissions
  * returns 1 when successful or -1 on error */
-extern int create_dir (const char *);
+extern int create_dir (const char *, short);
 
 /* build an absolute path of the file and returns a pointer to path string or
  * NULL in case of error */
 extern char * build_path (const char *, const char *);
 
-/* to build a destination path for a file to be moved, returns an absolute
- * path string or NULL in case of error    */
-extern char * dst_path (const char *);
+/* to build a destination path for a file to be moved, returns a path string
+ * relative to the destination directory, in the arena of the thread */
+extern char * dst_path (mctx *, const char *);
 
-/* open a file named by first argument and return an absolute path of this file
- * in location pointed to by src also returns file descriptor of the opened
- * file or -1 in case of error */
-extern int open_src_file (char *);
+/* path of a file for messages, in the arena of the thread */
+extern char * msg_path (mctx *, const char *);
+
+/* open a file named by the second argument, in the source directory of the
+ * operation, and return its file descriptor or -1 in case of error */
+extern int open_src_file (mctx *, char *);
 
 /* open a file named by first argument and return a file descriptor of the
  * opened file or -1 on error */
-extern int open_dst_file (char *);
+extern int open_dst_file (mctx *, char *);
 
 /* prompt user to enter choice [y/n] and return 1 for choice 'y' and 0
  * otherwise */
@@ -80,33 +143,252 @@ extern short get_choice (char *, const char *);
  * directory, returns a -1 on error or 1 on success */
 extern int update_mdb (char *);
 
-/* copy source file to destination file returns -1 on error or +1 when
- * successful */
-extern int copy_file (int, int);
+/* copy source file to destination file with the first copy engine that
+ * works, from an offset a stopped run copied it to, returns -1 on error or
+ * +1 when successful */
+extern int copy_file (mctx *, int, int, off_t, const char **);
 
 /* initialize move operation returns -1 on error or 1 when successful */
 extern int init_move (void);
 
+/* make a trash the one files are moved to, restored and deleted from */
+extern void use_trash (trash *);
+
+/* add a trash to the known ones returns it or NULL on error */
+extern trash * trash_add (char *, char *, char *, dev_t);
+
+/* return the trash for a file on the given device, the home trash when the
+ * mount of the file has none */
+extern trash * trash_of (const char *, dev_t);
+
+/* run the command line in ptrashd returns 0 with its exit status in the
+ * last argument, or -1 when there is no server to run it */
+extern int d_client (int, char *[], int *);
+
+/* serve requests as ptrashd; returns 0 in the child forked for a request,
+ * with its command line in the arguments, or -1 on error */
+extern int d_serve (int *, char ***);
+
+/* find the trashes of the mounted file systems returns the number known */
+extern int trash_scan (void);
+
+/* return a known trash, 0 being the home trash, or NULL past the last */
+extern trash * trash_get (int);
+
 /* checks the file type and calls the apropriate move_<type> function
  * to do the job */
-extern int move (char *, struct stat *);
+extern int move (mctx *, char *, struct stat *);
+
+/* rename a file to its destination when both lie on the same file system
+ * returns 0 on success, 1 if user declined to over write it and -1 when
+ * the file needs to be copied instead */
+extern int move_rename (mctx *, char *, struct stat *);
 
 /* function that actually moves regular file from source to .trash */
-extern int move_reg (char *);
+extern int move_reg (mctx *, char *);
+
+/* link a file to the copy of another of its links already in .trash,
+ * returns 0 on success or -1 if it is to be copied */
+extern int move_link (mctx *, char *, struct stat *);
+
+/* remember the copy in trash of a file with several links */
+extern void hl_add (const struct stat *, const char *);
+
+/* returns the path of the copy of an earlier link of a file, or NULL */
+extern char * hl_find (const struct stat *);
+
+/* reserve the trash entry of a file and queue its move to the background
+ * worker, returns 0 when queued or -1 if it is to be moved now */
+extern int move_async (mctx *, trash *, char *, struct stat *);
+
+/* journal a move left to the background worker returns -1 on error */
+extern int job_add (const char *, const char *);
+
+/* the worker has taken over a move, started it, and is done with it */
+extern void job_take (const char *);
+extern void job_start (const char *);
+extern void job_done (const char *);
+
+/* journal the move of a file copied to trash by this process, or take up
+ * the one left by a run that stopped, returns -1 if it is being moved */
+extern int job_open (const char *, const char *, tjob **);
+
+/* release a journaled move, dropping its job when the move is done */
+extern void job_close (tjob *, short);
+
+/* returns the offset the file open on a descriptor was copied to by the
+ * stopped run, or 0 */
+extern off_t job_offset (tjob *, int);
+
+/* journal the offset a file is copied to, and on disk */
+extern void job_mark (tjob *, const struct stat *, off_t);
+
+/* take up the moves of the runs that stopped returns their number */
+extern long job_resume (void (*) (const char *, const char *));
+
+/* the process is done with all its moves */
+extern void job_fini (void);
+
+/* returns a descriptor of the log of the background workers or -1 */
+extern int job_log (void);
+
+/* print the moves left to the background workers returns their number */
+extern long job_status (void);
 
 /* function to move the fifo special file to .trash */
-extern int move_fifo (char *);
+extern int move_fifo (mctx *, char *);
 
 /* function that moves directories from source to .trash */
-extern int move_dir (char *);
+extern int move_dir (mctx *, char *);
+
+/* remove a source directory once its entries are moved to .trash */
+extern void move_dir_done (mctx *, char *);
+
+/* move a directory to .trash with the pool of worker threads */
+extern int move_par (mctx *, char *, struct stat *);
 
 /* function to move character or block special files to .trash */
-extern int move_nod (char *);
+extern int move_nod (mctx *, char *);
 
 /* function to delete file from the .trash directory */
-extern int delete (char *, struct stat *);
+extern int delete (mctx *, int, char *, unsigned char);
+
+/* function to delete the contents of a directory from .trash */
+extern int delete_dir (mctx *, int, char *);
+
+/* remove an emptied directory from .trash */
+extern void delete_dir_done (mctx *, int, char *);
+
+/* delete a directory from .trash with the pool of worker threads */
+extern int delete_par (mctx *, int, char *);
+
+/* delete all the files from .trash returns -1 on error or 0 on success */
+extern int empty_trash (mctx *);
+
+/* evict the oldest files while .trash is over its limits, returns their
+ * number */
+extern int purge_trash (mctx *);
+
+/* position in the arena of a thread, see arena.c */
+typedef struct
+{
+    struct achunk *chunk;
+    size_t used;
+} amark;
+
+/* allocate from the arena of the calling thread, exits on error */
+extern void * arena_alloc (size_t);
+extern char * arena_strdup (const char *);
+extern char * arena_path (const char *, const char *);
+
+/* mark the arena of the calling thread, and release all allocated since */
+extern amark arena_mark (void);
+extern void arena_release (amark);
+
+/* batch of file system requests, see iob.c */
+typedef struct iobatch iobatch;
+
+/* returns the request batch of the calling thread */
+extern iobatch * iob_get (void);
+
+/* release the request batch of the calling thread */
+extern void iob_put (void);
+
+/* make room for a chain of linked requests in the batch */
+extern void iob_reserve (iobatch *, unsigned);
+
+/* submit queued requests and wait for them, returns the number completed */
+extern int iob_submit (iobatch *);
+
+/* queue statx, unlinkat, write, fsync and close requests; the result goes
+ * to the int pointed to by the last argument */
+extern void iob_statx (iobatch *, int, const char *, int, unsigned,
+                       struct statx *, int *);
+extern void iob_unlinkat (iobatch *, int, const char *, int, int *);
+extern void iob_write (iobatch *, int, const void *, size_t, off_t, int, int *);
+extern void iob_fsync (iobatch *, int, int, int *);
+extern void iob_close (iobatch *, int, int, int *);
+
+/* fill a stat structure from a statx structure */
+extern void statx_stat (const struct statx *, struct stat *);
+
+/* directory reader, see dents.c */
+typedef struct dents dents;
+
+/* start reading a directory with a buffer of the given size */
+extern dents * dents_open (int, size_t);
+
+/* start reading a directory into memory of the caller */
+extern dents * dents_init (int, void *, size_t);
+
+/* returns the next entry of the directory or NULL at the end */
+extern struct dirent64 * dents_read (dents *);
+
+/* read the rest of the directory and sort it by inode or by the place of
+ * the data on disk, returns the number of entries */
+extern size_t dents_sort (dents *, short);
+
+/* release the directory reader */
+extern void dents_close (dents *);
+
+/* add to a counter, and read it */
+extern void st_add (int, long long);
+extern long long st_get (int);
+
+/* the calling thread enters a phase, and leaves the last one it entered */
+extern void st_begin (int);
+extern void st_end (void);
+
+/* count system calls made for the phase of the calling thread */
+extern void st_sys (int);
+
+/* seconds spent in a phase, and since the start of the run */
+extern double st_ptime (int);
+extern double st_elapsed (void);
+
+/* format a number of bytes with a binary unit */
+extern char * st_size (char *, size_t, double);
+
+/* start timing the run, and the reporter line if asked */
+extern void st_init (short);
+
+/* write to the terminal of the reporter line without mixing into it */
+extern void st_hold (FILE *);
+extern void st_release (FILE *);
+extern void st_printf (FILE *, const char *, ...);
+
+/* stop the reporter and print the totals in the given format */
+extern void st_fini (FILE *, int);
+
+/* list of paths read by --from-file, see pathlist.c */
+typedef struct plist plist;
+
+/* read the paths of a file, "-" for stdin, separated by the given byte */
+extern plist * pl_read (const char *, int);
+
+/* number of paths, and a path as it was read */
+extern size_t pl_size (plist *);
+extern char * pl_path (plist *, size_t);
+
+/* sort the paths by device and parent directory */
+extern int pl_sort (plist *);
+
+/* next sorted path and its stat, returns 0 at the end, -1 if not found */
+extern int pl_next (plist *, char **, struct stat *);
+
+/* release the list of paths */
+extern void pl_free (plist *);
+
+/* start a pool of worker threads returns -1 on error or 1 when successful */
+extern int pool_init (int);
+
+/* queue a function to run on one of the pool threads */
+extern void pool_submit (void (*) (void *), void *);
+
+/* wait until the queued functions, and those queued by them, are done */
+extern void pool_wait (void);
 
-/* function to delete directory from .trash */
-int delete_dir (char *);
+/* stop the pool threads */
+extern void pool_fini (void);
 
 #endif
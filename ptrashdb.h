@@ -21,6 +21,7 @@
 #define MOVEDB_H
 
 #include <ptrash.h>
+#include <time.h>
 
 typedef struct node
 {
@@ -37,12 +38,22 @@ typedef struct
 /* create and return a new node to insert it into trashdb */
 extern node * get_node (const char *);
 
-/* insert a new node into trashdb returns +1 on success and -1 on error */
-extern int t_insert (const char *);
+/* switch to the info directory of a trash, relative paths are from the
+ * second argument */
+extern void t_use (const char *, const char *);
+
+/* insert a new node into trashdb, with the disk usage of the file */
+extern void t_insert (const char *, long long);
 
 /* delete node from trashdb, containing string supplied as an argument */
 extern void t_delete (const char *);
 
+/* delete all the records left in trashdb */
+extern void t_empty (void);
+
+/* flush the records written in --sync=batch mode */
+extern void t_sync (void);
+
 /* modify node with path supplied as argument */
 extern void t_modify (node *, const char *);
 
@@ -50,6 +61,12 @@ extern void t_modify (node *, const char *);
  * a copy of the path string */
 extern char * t_search (const char *);
 
+/* return a copy of the trash name of a file from its original path */
+extern char * t_lookup (const char *);
+
+/* parse a trash info file returns 0 on success and -1 on error */
+extern int t_parse (int, const char *, char **, time_t *);
+
 /* search a node matching the basename string of the supplied path and returns
  * the node to calling function */
 extern node * t_search_node (const char *);
@@ -57,10 +74,83 @@ extern node * t_search_node (const char *);
 /* display trashdb */
 extern void t_display (void);
 
+/* record the disk usage of a file once its move in the background is done */
+extern void t_setsize (const char *, long long);
+
+/* returns 1 if the trash info record of a file is written, 0 otherwise */
+extern int t_exists (const char *);
+
+/* print the sorted entries of the trash returns their number or -1 */
+extern long t_list (short, short);
+
+/* print the disk usage of the trash returns -1 on error */
+extern long long t_du (void);
+
+/* count entries of unknown size returns the disk usage of trash or -1 */
+extern long long t_count (void);
+
+/* return the name of the oldest entry if it is over the size or age limit */
+extern char * t_evict (long long, long, time_t);
+
+/* reopen the info directories and catalogs, in a child of ptrashd */
+extern void t_detach (void);
+
+/* write Trash/directorysizes if directories came or went */
+extern void t_dirsizes (void);
+
 /* initialize and build trashdb */
 extern void t_read (void);
 
 /* write trashdb to file pointed to by tdb */
 extern int t_write (void);
 
+/* catalog of Trash/info, see catalog.c */
+typedef struct catalog catalog;
+
+/* an entry of the catalog, as passed to c_foreach */
+typedef struct
+{
+    const char *name;       /* name under Trash/files */
+    const char *path;       /* original path */
+    time_t date;            /* deletion date */
+    long long size;         /* disk usage in bytes, -1 if not known */
+    short dir;              /* a directory */
+} centry;
+
+/* open the catalog of an info directory returns NULL if it is not usable */
+extern catalog * c_open (const char *);
+
+/* take descriptors of its own for the catalog, in a child of ptrashd */
+extern void c_detach (catalog *);
+
+/* rebuild the catalog if info directory has changed returns -1 on error */
+extern int c_refresh (catalog *);
+
+/* lock and unlock the catalog around a change of info directory */
+extern void c_begin (catalog *);
+extern void c_end (catalog *);
+
+/* record an entry added to or removed from info directory */
+extern int c_insert (catalog *, const centry *, const struct timespec *);
+extern int c_remove (catalog *, const char *);
+
+/* record the disk usage of an entry once it is counted */
+extern int c_setsize (catalog *, const char *, long long);
+
+/* total disk usage and number of entries of unknown size, without a walk */
+extern long long c_usage (catalog *, long *);
+
+/* write the sizes of directories to Trash/directorysizes */
+extern int c_dirsizes (catalog *);
+
+/* return a copy of the original path of a trash name, and the other way */
+extern char * c_lookup (catalog *, const char *);
+extern char * c_lookup_path (catalog *, const char *);
+
+/* the oldest entry returns -1 if there is none */
+extern int c_oldest (catalog *, centry *);
+
+/* call a function for each entry returns their number or -1 on error */
+extern long c_foreach (catalog *, void (*) (const centry *, void *), void *);
+
 #endif
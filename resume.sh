@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# resume.sh -- move unwanted files to trash; This file is part of the program
+# 'ptrash'.
+# Copyright (C) 2026 Prasad J Pandit
+#
+# 'ptrash' is a free software; you can redistribute it and/or modify it under
+# the terms of GNU General Public Licence as published by Free Software
+# Foundation; either version 2 of the licence, or (at your option) any later
+# version.
+#
+# Take up moves across file systems that stopped half way, as run by
+# `make check':
+#
+#   sh resume.sh PTRASH
+#
+# The journal and the partial copies a run leaves behind when it is killed
+# are made here, so that the test does not race with a copy: a file copied
+# up to a Copy= mark, another copied whole with its source not yet removed,
+# and one whose source is gone but whose trash info record was not written.
+# Their process is gone, its lock is left, and a log is in the journal.
+# `ptrash --resume' is to finish all three, copy no more than what was left,
+# and clear the journal.
+#
+# RESUME_SRC  a directory on another file system than $TMPDIR, where the
+#             sources are made; /dev/shm by default. The test is skipped
+#             without one.
+#
+
+PTRASH=${1:-./ptrash}
+SRC=${RESUME_SRC:-/dev/shm}
+MB=1048576
+
+case $PTRASH in /*) ;; *) PTRASH=$PWD/$PTRASH ;; esac
+
+D=$(mktemp -d "${TMPDIR:-/tmp}/ptrash-resume.XXXXXX") || exit 1
+S=$SRC/ptrash-resume.$$
+trap 'rm -rf "$D" "$S"' EXIT
+trap 'exit 1' HUP INT TERM
+if ! mkdir "$S" 2>/dev/null \
+   || [ "$(stat -c %d "$S")" = "$(stat -c %d "$D")" ]; then
+    echo "resume: no file system other than that of $D, skipped"
+    exit 77
+fi
+
+export XDG_DATA_HOME=$D/data
+export XDG_RUNTIME_DIR=$D/run       # no ptrashd serves the run
+T=$XDG_DATA_HOME/Trash
+mkdir -p "$XDG_RUNTIME_DIR" "$T/files" "$T/info" "$T/ptrash.jobs"
+
+fail ()
+{
+    echo "resume: $*" >&2
+    exit 1
+}
+
+# a process that is gone
+pid=$(sh -c 'echo $$')
+: > "$T/ptrash.jobs/$pid.lock"
+: > "$T/ptrash.jobs/log"
+
+# job NAME [OFFSET]: the journal of a move of $S/NAME, copied up to OFFSET
+job ()
+{
+    {
+        printf '[Trash Job]\nPath=%s\nPid=%s\nStarted=%s\n' "$S/$1" $pid \
+               "$(date +%s)"
+        [ -n "$2" ] && printf 'Copy=%s %s\n' \
+            "$(stat -c '%d:%i %s %Y' "$S/$1")" $2
+    } > "$T/ptrash.jobs/$1.job"
+}
+
+# half: 3 MiB, copied up to 1 MiB; what is past it in the copy is not
+dd if=/dev/urandom of="$S/half" bs=$MB count=3 2>/dev/null
+dd if="$S/half" of="$T/files/half" bs=$MB count=1 2>/dev/null
+dd if=/dev/zero of="$T/files/half" bs=$MB seek=1 count=1 2>/dev/null
+job half $MB
+
+# whole: 2 MiB, copied whole, but its source is left
+dd if=/dev/urandom of="$S/whole" bs=$MB count=2 2>/dev/null
+cp "$S/whole" "$T/files/whole"
+job whole $((2 * MB))
+
+# gone: copied whole and its source removed, no trash info record yet
+dd if=/dev/urandom of="$T/files/gone" bs=$MB count=1 2>/dev/null
+job gone
+
+cp "$S/half" "$D/half"
+cp "$S/whole" "$D/whole"
+
+"$PTRASH" --stats=json --resume 2>"$D/stats" || fail "ptrash exited with $?"
+grep -q '"bytes_copied":2097152,' "$D/stats" \
+    || fail "copied other than the 2 MiB left: $(cat "$D/stats")"
+for f in half whole; do
+    cmp -s "$D/$f" "$T/files/$f" || fail "$f differs from its source"
+    [ ! -e "$S/$f" ] || fail "source of $f is left"
+done
+for f in half whole gone; do
+    grep -q "^Path=$S/$f\$" "$T/info/$f.trashinfo" 2>/dev/null \
+        || fail "no trash info record of $f"
+done
+[ -z "$(cd "$T/ptrash.jobs" && ls | grep -v '^log$')" ] \
+    || fail "journal left: $(ls "$T/ptrash.jobs")"
+"$PTRASH" --status | grep -q . && fail "--status still lists moves"
+
+exit 0
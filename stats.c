@@ -0,0 +1,387 @@
+/*
+ * stats.c -- move unwanted files to trash; This file is part of the program
+ * 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Statistics of an invocation. The movers bump counters with relaxed atomic
+ * adds, once per chunk copied or file moved. A phase of a move, such as the
+ * copy of a file, is timed between st_begin and st_end with the monotonic
+ * clock; phases nest, and the time of an inner one is not counted in the
+ * outer. Each phase has the number of its runs, of the system calls made
+ * for it, its total time and a histogram of its run times in powers of two
+ * of microseconds. A reporter thread samples the counters every ST_PERIOD
+ * and keeps a line of throughput on the terminal; the messages of -v are
+ * written between st_hold and st_release, which clear the line and draw it
+ * again. The totals are printed as text or JSON when the run is over.
+ * Nothing is printed from the copy loops.
+ */
+
+#include <ptrash.h>
+#include <time.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#define ST_PERIOD       100     /* milliseconds between two samples */
+#define ST_NEST         8       /* phases open at once in a thread */
+#define ST_HIST         24      /* histogram buckets, up to 2^22 us and over */
+
+extern char *prog;
+
+/* totals of a phase */
+typedef struct
+{
+    long long runs;
+    long long sys;          /* system calls */
+    long long ns;
+    long long hist[ST_HIST];
+} phase;
+
+/* a phase open in a thread */
+typedef struct
+{
+    int p;
+    long long start;
+    long long inner;        /* time of the phases nested in it */
+} pframe;
+
+short st_on = 0;            /* phases are timed */
+
+static long long cnt[ST_MAX];
+static phase ph[PH_MAX];
+static long long tstart = 0;
+static __thread pframe pst[ST_NEST];
+static __thread int npst = 0;
+static FILE *live = NULL;   /* terminal of the reporter */
+static short shared = 0;    /* the standard output goes there too */
+static char lline[256];     /* line last drawn by the reporter */
+static short stop = 0;
+static pthread_t rep;
+static pthread_mutex_t slock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scond = PTHREAD_COND_INITIALIZER;
+
+static const char *pnames[PH_MAX] = \
+    { "readdir", "stat", "rename", "copy", "record", "remove" };
+static const char *cnames[ST_MAX] = \
+    { "files", "directories", "renames", "copies", "links", "bytes_copied",
+      "bytes_found", "regular", "directory", "fifo", "device", "other" };
+
+
+static long long
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* st_add: add @n to the counter @c */
+void
+st_add (int c, long long n)
+{
+    __atomic_add_fetch (&cnt[c], n, __ATOMIC_RELAXED);
+}
+
+
+/* st_get: returns the counter @c */
+long long
+st_get (int c)
+{
+    return __atomic_load_n (&cnt[c], __ATOMIC_RELAXED);
+}
+
+
+/* st_begin: the calling thread enters the phase @p */
+void
+st_begin (int p)
+{
+    if (!st_on)
+        return;
+    if (npst < ST_NEST)
+    {
+        pst[npst].p = p;
+        pst[npst].start = now ();
+        pst[npst].inner = 0;
+    }
+    npst++;
+}
+
+
+/* st_end: the calling thread leaves the phase it entered last */
+void
+st_end (void)
+{
+    int b = 0;
+    long long t = 0, us = 0;
+    pframe *o = NULL;
+
+    if (!st_on || !npst || --npst >= ST_NEST)
+        return;
+    o = &pst[npst];
+    t = now () - o->start;
+    if (npst)
+        pst[npst - 1].inner += t;
+    t -= o->inner;
+    for (us = t / 1000; us && b < ST_HIST - 1; us >>= 1)
+        b++;
+    __atomic_add_fetch (&ph[o->p].runs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&ph[o->p].ns, t, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&ph[o->p].hist[b], 1, __ATOMIC_RELAXED);
+}
+
+
+/* st_sys: count @n system calls made for the phase the thread is in */
+void
+st_sys (int n)
+{
+    if (st_on && npst && npst <= ST_NEST)
+        __atomic_add_fetch (&ph[pst[npst - 1].p].sys, n, __ATOMIC_RELAXED);
+}
+
+
+/* st_ptime: returns the seconds spent in phase @p */
+double
+st_ptime (int p)
+{
+    return __atomic_load_n (&ph[p].ns, __ATOMIC_RELAXED) / 1e9;
+}
+
+
+/* st_elapsed: returns the seconds since st_init */
+double
+st_elapsed (void)
+{
+    return (now () - tstart) / 1e9;
+}
+
+
+/*
+ * st_size: format @n bytes in @buf with a binary unit, as in "12.3 MiB".
+ */
+char *
+st_size (char *buf, size_t len, double n)
+{
+    int i = 0;
+    const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+
+    while (n >= 1024 && i < 5)
+    {
+        n /= 1024;
+        i++;
+    }
+    snprintf (buf, len, i ? "%.1f %s" : "%.0f %s", n, units[i]);
+
+    return buf;
+}
+
+
+/*
+ * st_line: draw the line of the reporter, from the counters and their
+ * previous sample @lb, @lf taken @dt seconds ago.
+ */
+static void
+st_line (long long *lb, long long *lf, double dt)
+{
+    char b[16], r[16], eta[32] = "--:--";
+    long long by = st_get (ST_BYTES), fl = st_get (ST_FILES);
+    long long left = st_get (ST_SEEN) - by;
+    double bps = (by - *lb) / dt, fps = (fl - *lf) / dt;
+
+    if (bps > 0 && left > 0 && left / bps < 360000)
+        snprintf (eta, sizeof (eta), "%ld:%02ld", (long) (left / bps) / 60,
+                  (long) (left / bps) % 60);
+    snprintf (lline, sizeof (lline), "\r%s: %s copied, %s/s, %lld files, "
+              "%.0f files/s, ETA %s\033[K", prog, st_size (b, sizeof (b), by),
+              st_size (r, sizeof (r), bps), fl, fps, eta);
+    fputs (lline, live);
+    fflush (live);
+    *lb = by;
+    *lf = fl;
+}
+
+
+static void *
+st_report (void *arg)
+{
+    long long lb = 0, lf = 0, t = now (), n = 0;
+    struct timespec ts;
+
+    (void) arg;
+    pthread_mutex_lock (&slock);
+    while (!stop)
+    {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_nsec += ST_PERIOD * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        if (pthread_cond_timedwait (&scond, &slock, &ts) != ETIMEDOUT)
+            continue;
+        n = now ();
+        st_line (&lb, &lf, (n - t) / 1e9);
+        t = n;
+    }
+    pthread_mutex_unlock (&slock);
+
+    return NULL;
+}
+
+
+/*
+ * st_init: start timing the phases of the run. With @show set, a reporter
+ * thread keeps a line of throughput on the standard error, when it is a
+ * terminal. The messages of -v, written to the same terminal in between,
+ * take it over with st_hold.
+ */
+void
+st_init (short show)
+{
+    struct stat eb, ob;
+
+    st_on = 1;
+    tstart = now ();
+    if (!show || !isatty (STDERR_FILENO) || fstat (STDERR_FILENO, &eb) < 0)
+        return;
+    shared = isatty (STDOUT_FILENO) && !fstat (STDOUT_FILENO, &ob)
+             && ob.st_rdev == eb.st_rdev;
+    lline[0] = '\0';
+    live = stderr;
+    if (pthread_create (&rep, NULL, st_report, NULL))
+        live = NULL;
+}
+
+
+/* st_mine: returns 1 if writes to @fp go over the line of the reporter */
+static int
+st_mine (FILE *fp)
+{
+    return live != NULL && (fp == stderr || (fp == stdout && shared));
+}
+
+
+/*
+ * st_hold: take the terminal from the reporter before writing to @fp, and
+ * clear its line. Sampling waits until st_release draws the line again.
+ */
+void
+st_hold (FILE *fp)
+{
+    if (!st_mine (fp))
+        return;
+    pthread_mutex_lock (&slock);
+    fputs ("\r\033[K", live);
+}
+
+
+/* st_release: give the terminal back to the reporter after st_hold */
+void
+st_release (FILE *fp)
+{
+    if (!st_mine (fp))
+        return;
+    fflush (fp);
+    fputs (lline, live);
+    fflush (live);
+    pthread_mutex_unlock (&slock);
+}
+
+
+/* st_printf: fprintf to @fp, without mixing it into the reporter's line */
+void
+st_printf (FILE *fp, const char *fmt, ...)
+{
+    va_list ap;
+
+    st_hold (fp);
+    va_start (ap, fmt);
+    vfprintf (fp, fmt, ap);
+    va_end (ap);
+    st_release (fp);
+}
+
+
+/* st_json: print the statistics as one JSON object to @fp */
+static void
+st_json (FILE *fp)
+{
+    int c = 0, p = 0, h = 0;
+
+    fprintf (fp, "{\"program\":\"ptrash\",\"version\":\"%s\","
+             "\"elapsed_ns\":%lld,\"counts\":{", VERSION, now () - tstart);
+    for (c = 0; c < ST_MAX; c++)
+        fprintf (fp, "%s\"%s\":%lld", c ? "," : "", cnames[c], st_get (c));
+    fprintf (fp, "},\"phases\":{");
+    for (p = 0; p < PH_MAX; p++)
+    {
+        fprintf (fp, "%s\"%s\":{\"runs\":%lld,\"syscalls\":%lld,\"ns\":%lld,"
+                 "\"hist_log2_us\":[", p ? "," : "", pnames[p],
+                 __atomic_load_n (&ph[p].runs, __ATOMIC_RELAXED),
+                 __atomic_load_n (&ph[p].sys, __ATOMIC_RELAXED),
+                 __atomic_load_n (&ph[p].ns, __ATOMIC_RELAXED));
+        for (h = 0; h < ST_HIST; h++)
+            fprintf (fp, "%s%lld", h ? "," : "",
+                     __atomic_load_n (&ph[p].hist[h], __ATOMIC_RELAXED));
+        fprintf (fp, "]}");
+    }
+    fprintf (fp, "}}\n");
+}
+
+
+/*
+ * st_fini: stop the reporter, and print the totals of the run and the time
+ * spent in each phase to @fp in the format @fmt, STATS_TEXT or STATS_JSON.
+ * With STATS_NONE, the reporter is stopped only.
+ */
+void
+st_fini (FILE *fp, int fmt)
+{
+    int p = 0;
+    char b[16], r[16];
+    double el = 0;
+
+    if (!st_on)
+        return;
+    if (live != NULL)
+    {
+        pthread_mutex_lock (&slock);
+        stop = 1;
+        pthread_cond_signal (&scond);
+        pthread_mutex_unlock (&slock);
+        pthread_join (rep, NULL);
+        fprintf (live, "\r\033[K");
+        live = NULL;
+    }
+    if (fmt == STATS_JSON)
+        st_json (fp);
+    if (fmt != STATS_TEXT)
+        return;
+
+    el = st_elapsed ();
+    fprintf (fp, "%s: %lld files, %lld directories, %lld renamed; %s copied in "
+             "%.2f s, %s/s, %.0f files/s\n", prog, st_get (ST_FILES),
+             st_get (ST_DIRS), st_get (ST_RENAMES),
+             st_size (b, sizeof (b), st_get (ST_BYTES)), el,
+             st_size (r, sizeof (r), el > 0 ? st_get (ST_BYTES) / el : 0),
+             el > 0 ? st_get (ST_FILES) / el : 0);
+    fprintf (fp, "%s: time in", prog);
+    for (p = 0; p < PH_MAX; p++)
+        fprintf (fp, "%s %s %.2f s", p ? "," : "", pnames[p], st_ptime (p));
+    fprintf (fp, "\n");
+}
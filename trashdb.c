@@ -19,105 +19,712 @@
  */
 
 #include <ptrash.h>
+#include <ptrashdb.h>
 #include <time.h>
 
+extern short mode;
+
 char *tdb = NULL;
+short tsync = SYNC_FULL;
 
-void
-t_insert (const char *path)
+/* an info directory in use, one per trash */
+typedef struct tdir
 {
+    char *path;
+    char *top;              /* relative original paths are from here */
+    char *files;            /* files directory, for t_du */
     int fd;
+    catalog *cat;
+    short dirty;            /* records changed since the last t_sync */
+    short dsdirty;          /* directories came or went, for t_dirsizes */
+    struct tdir *next;
+} tdir;
+
+static tdir *tdirs = NULL;
+static tdir *tcur = NULL;   /* that of tdb */
+
+/*
+ * t_use: make @info, ending in `info/', the info directory records go to,
+ * opening it and its catalog the first time. Relative original paths in its
+ * records are from @top. Worker threads are idle while it is switched.
+ */
+void
+t_use (const char *info, const char *top)
+{
+    tdir *d = NULL;
+    size_t l = 0;
+
+    assert (info != NULL && top != NULL);
+
+    for (d = tdirs; d != NULL && strcmp (d->path, info); d = d->next)
+        ;
+    if (d == NULL)
+    {
+        l = strlen (info);
+        if ((d = calloc (1, sizeof (tdir))) == NULL
+            || (d->path = strdup (info)) == NULL
+            || (d->top = strdup (top)) == NULL
+            || (d->files = malloc (l + 1)) == NULL)
+            err (-1, "could not open directory `%s'", info);
+        snprintf (d->files, l + 1, "%.*sfiles", (int) (l > 5 ? l - 5 : 0),
+                  info);
+        if ((d->fd = open (info, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+            warn ("could not open directory `%s'", info);
+        d->cat = c_open (info);
+        d->next = tdirs;
+        tdirs = d;
+    }
+    tdb = d->path;
+    tcur = d;
+}
+
+/*
+ * t_detach: reopen the info directories and catalogs in use, in a child
+ * forked by ptrashd, so that their offsets and locks are its own.
+ */
+void
+t_detach (void)
+{
+    int fd = -1;
+    tdir *d = NULL;
+
+    for (d = tdirs; d != NULL; d = d->next)
+    {
+        if (d->fd >= 0
+            && (fd = open (d->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) >= 0)
+        {
+            close (d->fd);
+            d->fd = fd;
+        }
+        if (d->cat != NULL)
+            c_detach (d->cat);
+    }
+}
+
+static tdir *
+t_cur (void)
+{
+    assert (tcur != NULL);
+
+    return tcur;
+}
+
+/*
+ * t_insert: write the trash info record of a file just moved to trash, and
+ * add it to the catalog along with @size, its disk usage or -1 if it is
+ * not known.
+ */
+void
+t_insert (const char *path, long long size)
+{
+    tdir *td = NULL;
+    int fd, res[3];
+    size_t n = 0;
     time_t t = 0;
-    char buf[1024], dtm[20], *fp = NULL;
+    struct tm tm;
+    struct stat st;
+    iobatch *b = iob_get ();
+    char buf[PATH_MAX + 64], nm[NAME_MAX + 1], dtm[20], *fp = NULL;
 
     assert (path != NULL);
 
-    snprintf (buf, sizeof (buf), "%s.trashinfo", basename (path));
-    fp = build_path (tdb, buf);
-    fd = open (fp, O_CREAT|O_EXCL|O_WRONLY, S_IRUSR | S_IWUSR);
+    td = t_cur ();
+    snprintf (nm, sizeof (nm), "%s.trashinfo", basename (path));
+    fp = build_path (tdb, nm);
+    if (td->cat != NULL)
+        c_begin (td->cat);
+    fd = open (fp, O_CREAT|O_EXCL|O_WRONLY|O_CLOEXEC, S_IRUSR | S_IWUSR);
+    st_sys (1);
     if (fd < 0)
+    {
         warn ("could not open file: `%s'", fp);
+        goto out;
+    }
 
     time (&t);
-    strftime (dtm, sizeof (dtm), "%Y%m%dT%T", localtime (&t));
-    t = snprintf (buf, sizeof (buf),
+    strftime (dtm, sizeof (dtm), "%Y%m%dT%T", localtime_r (&t, &tm));
+    n = snprintf (buf, sizeof (buf),
                 "%s\nPath=%s\nDeletionDate=%s\n", "[Trash Info]", path, dtm);
 
-    write (fd, buf, t);
-    fsync (fd);
+    /* write, fsync and close as one chain of requests */
+    res[1] = 0;
+    iob_reserve (b, 3);
+    iob_write (b, fd, buf, n, 0, IOB_LINK, &res[0]);
+    if (tsync == SYNC_FULL)
+        iob_fsync (b, fd, IOB_LINK, &res[1]);
+    iob_close (b, fd, 0, &res[2]);
+    iob_submit (b);
+    __atomic_store_n (&td->dirty, 1, __ATOMIC_RELAXED);
+    if (res[0] < 0 || res[1] < 0)
+    {
+        errno = res[0] < 0 ? -res[0] : -res[1];
+        warn ("could not write file `%s'", fp);
+    }
+    else if (td->cat != NULL && !fstatat (td->fd, nm, &st, 0))
+    {
+        struct stat fst;
+        centry e = { nm, path, t, size, 0 };
+
+        nm[strlen (nm) - 10] = '\0';
+        snprintf (buf, sizeof (buf), "../files/%s", nm);
+        if (!fstatat (td->fd, buf, &fst, AT_SYMLINK_NOFOLLOW)
+            && S_ISDIR (fst.st_mode))
+        {
+            e.dir = 1;
+            __atomic_store_n (&td->dsdirty, 1, __ATOMIC_RELAXED);
+        }
+        c_insert (td->cat, &e, &st.st_mtim);
+    }
 
+out:
+    if (td->cat != NULL)
+        c_end (td->cat);
     free (fp);
-    close (fd);
+}
+
+/*
+ * t_setsize: record @size, the disk usage of the file moved from @path by
+ * the background worker, in the record written when its move was queued.
+ */
+void
+t_setsize (const char *path, long long size)
+{
+    tdir *td = NULL;
+    struct stat st;
+    char buf[NAME_MAX + 16];
+
+    assert (path != NULL);
+
+    td = t_cur ();
+    snprintf (buf, sizeof (buf), "../files/%s", basename (path));
+    if (td->cat != NULL && !c_setsize (td->cat, basename (path), size)
+        && !fstatat (td->fd, buf, &st, AT_SYMLINK_NOFOLLOW)
+        && S_ISDIR (st.st_mode))
+        td->dsdirty = 1;
+}
+
+/*
+ * t_exists: returns 1 if the trash info record of the file moved from
+ * @path is written, 0 otherwise.
+ */
+int
+t_exists (const char *path)
+{
+    char buf[NAME_MAX + 16];
+
+    assert (path != NULL);
+
+    snprintf (buf, sizeof (buf), "%s.trashinfo", basename (path));
+    st_sys (1);
+
+    return !faccessat (t_cur ()->fd, buf, F_OK, AT_SYMLINK_NOFOLLOW);
 }
 
 void
 t_delete (const char *path)
 {
-    char buf[1024], *fp = NULL;
+    tdir *td = NULL;
+    char buf[1024];
 
     assert (path != NULL);
 
     snprintf (buf, sizeof (buf), "%s.trashinfo", basename (path));
-    fp = build_path (tdb, buf);
+    td = t_cur ();
+    if (td->cat != NULL)
+        c_begin (td->cat);
+    if (unlinkat (td->fd, buf, 0) < 0)
+        warn ("could not remove file `%s%s'", tdb, buf);
+    else if (td->cat != NULL && c_remove (td->cat, basename (path)) > 0)
+        __atomic_store_n (&td->dsdirty, 1, __ATOMIC_RELAXED);
+    if (td->cat != NULL)
+        c_end (td->cat);
+    __atomic_store_n (&td->dirty, 1, __ATOMIC_RELAXED);
+}
 
-    if (truncate (fp, 0) < 0)
-        warn ("could not truncate file `%s'", fp);
-    if (unlink (fp) < 0)
-        warn ("could not remove file `%s'", fp);
+void
+t_empty (void)
+{
+    tdir *td = NULL;
+    DIR *d = NULL;
+    struct dirent *dent = NULL;
 
-    free (fp);
+    td = t_cur ();
+    if ((d = fdopendir (dup (td->fd))) == NULL)
+        return;
+
+    while ((dent = readdir (d)) != NULL)
+    {
+        size_t l = strlen (dent->d_name);
+
+        if (l > 10 && !strcmp (&dent->d_name[l - 10], ".trashinfo")
+            && unlinkat (td->fd, dent->d_name, 0) < 0)
+            warn ("could not remove file `%s%s'", tdb, dent->d_name);
+    }
+    closedir (d);
 }
 
-static char *
-read_line (int fd)
+/*
+ * t_parse: parse the trash info record @file in directory @dfd, read with a
+ * single read(2). Returns 0 and sets @path to a copy of the original path
+ * and @date to the deletion date on success, or -1 on error.
+ */
+int
+t_parse (int dfd, const char *file, char **path, time_t *date)
 {
-    int i = 0;
-    char buf[1024];
+    int fd = -1;
+    ssize_t n = 0;
+    struct tm tm;
+    char buf[PATH_MAX + 128], *ln = NULL, *nl = NULL;
+
+    assert (file != NULL && path != NULL);
+
+    *path = NULL;
+    if ((fd = openat (dfd, file, O_RDONLY|O_CLOEXEC)) < 0)
+    {
+        warn ("could not open file `%s%s'", tdb, file);
+        return -1;
+    }
+    n = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+    if (n < 0)
+    {
+        warn ("could not read file `%s%s'", tdb, file);
+        return -1;
+    }
+    buf[n] = '\0';
 
-    while (read (fd, &buf[i], 1) > 0)
+    if (strncmp (buf, "[Trash Info]\n", sizeof ("[Trash Info]")))
+    {
+        warnx ("invalid Trash Info entry `%s%s'", tdb, file);
+        return -1;
+    }
+    for (ln = buf; ln != NULL && *ln; ln = nl)
+    {
+        if ((nl = strchr (ln, '\n')) != NULL)
+            *nl++ = '\0';
+
+        if (!strncmp (ln, "Path=", sizeof ("Path")) && *path == NULL)
+            *path = strdup (&ln[5]);
+        else if (!strncmp (ln, "DeletionDate=", sizeof ("DeletionDate"))
+                 && date != NULL)
+        {
+            memset (&tm, 0, sizeof (tm));
+            tm.tm_isdst = -1;
+            *date = strptime (&ln[13], "%Y%m%dT%T", &tm) ? mktime (&tm) : 0;
+        }
+    }
+    if (*path == NULL)
     {
-        if (buf[i] == '\n')
-            break;
-        i++;
+        warnx ("invalid Path entry `%s%s'", tdb, file);
+        return -1;
     }
-    buf[i++] = '\0';
 
-    return strndup (buf, i);
+    return 0;
 }
 
 char *
 t_search (const char *path)
 {
-    int fd;
-    char *ret = NULL;
-    char buf[1024], *fp = NULL, *ln = NULL;
+    tdir *td = NULL;
+    char buf[NAME_MAX + 1], *ret = NULL;
 
     assert (path != NULL);
 
-    snprintf (buf, sizeof (buf), "%s.trashinfo", basename (path));
-    fp = build_path (tdb, buf);
-    fd = open (fp, O_RDONLY|O_CLOEXEC);
-    if (fd < 0)
-        warn ("could not open file `%s'", fp);
+    td = t_cur ();
+    if (td->cat != NULL)
+        ret = c_lookup (td->cat, basename (path));
 
-    ln = read_line (fd);
-    if (strncmp (ln, "[Trash Info]", sizeof ("[Trash Info]")))
-        warnx ("invalid Trash Info entry `%s'", fp);
-    free (ln);
+    if (ret == NULL)
+    {
+        snprintf (buf, sizeof (buf), "%s.trashinfo", basename (path));
+        t_parse (td->fd, buf, &ret, NULL);
+    }
+    if (ret != NULL && ret[0] != '/')
+    {
+        char *rel = ret;
 
-    ln = read_line (fd);
-    if (strncmp (ln, "Path=", sizeof ("Path")))
-        warnx ("invalid Path entry `%s'", fp);
-    ret = strdup (&ln[5]);
-    free (ln);
+        ret = build_path (td->top, rel);
+        free (rel);
+    }
 
-    ln = read_line (fd);
-    if (strncmp (ln, "DeletionDate=", sizeof ("DeletionDate")))
-        warnx ("invalid Date entry `%s'", fp);
-    free (ln);
+    return ret;
+}
 
-    free (fp);
-    close (fd);
+/*
+ * t_lookup: returns the trash name of the most recently deleted file whose
+ * original path is @path, or NULL if there is none.
+ */
+char *
+t_lookup (const char *path)
+{
+    tdir *td = NULL;
+    char *d = NULL, *rp = NULL, *ret = NULL;
+
+#ifdef __GLIBC__
+    extern char * dirname (char *);
+#endif
+
+    assert (path != NULL);
+
+    td = t_cur ();
+    if (td->cat == NULL || (d = strdup (path)) == NULL)
+        return NULL;
+
+    /* the file itself is gone, resolve its directory */
+    if ((rp = realpath (dirname (d), NULL)) != NULL)
+    {
+        free (d);
+        d = build_path (rp, basename (path));
+        ret = c_lookup_path (td->cat, d);
+        free (rp);
+    }
+    free (d);
 
     return ret;
 }
+
+/* entries collected for t_list */
+typedef struct
+{
+    centry *e;
+    size_t n, cap;
+} tlist;
+
+static short tkey = SORT_DATE;
+
+static void
+t_collect (const centry *e, void *arg)
+{
+    tlist *l = arg;
+
+    if (l->n == l->cap)
+    {
+        centry *p = realloc (l->e, (l->cap = l->cap ? l->cap * 2 : 1024)
+                                   * sizeof (centry));
+        if (p == NULL)
+            err (-1, "could not list trash");
+        l->e = p;
+    }
+    l->e[l->n] = *e;
+    l->e[l->n].name = strdup (e->name);
+    l->e[l->n].path = strdup (e->path);
+    if (l->e[l->n].name == NULL || l->e[l->n].path == NULL)
+        err (-1, "could not list trash");
+    l->n++;
+}
+
+static int
+t_cmp (const void *a, const void *b)
+{
+    const centry *x = a, *y = b;
+
+    if (tkey == SORT_SIZE && x->size != y->size)
+        return x->size < y->size ? 1 : -1;      /* largest first */
+    if (tkey == SORT_PATH)
+        return strcmp (x->path, y->path);
+    if (x->date != y->date)
+        return x->date < y->date ? -1 : 1;      /* oldest first */
+
+    return strcmp (x->name, y->name);
+}
+
+/* t_json: print a JSON string */
+static void
+t_json (FILE *out, const char *s)
+{
+    fputc ('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf (out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf (out, "\\u%04x", *s);
+        else
+            fputc (*s, out);
+    }
+    fputc ('"', out);
+}
+
+/*
+ * t_list: print the entries of the trashes in use sorted by @key, one of
+ * SORT_DATE, SORT_SIZE or SORT_PATH, in the format @fmt: LIST_TEXT,
+ * LIST_JSON or LIST_NUL. Returns the number of entries, or -1 on error.
+ */
+long
+t_list (short key, short fmt)
+{
+    tdir *td = NULL;
+    size_t i = 0;
+    struct tm tm;
+    tlist l = { NULL, 0, 0 };
+    char dtm[24], sz[24];
+    static char obuf[1024 * 1024];
+
+    for (td = tdirs; td != NULL; td = td->next)
+        if (td->cat == NULL || c_foreach (td->cat, t_collect, &l) < 0)
+        {
+            warnx ("could not read trash catalog of `%s'", td->path);
+            return -1;
+        }
+    tkey = key;
+    qsort (l.e, l.n, sizeof (centry), t_cmp);
+
+    setvbuf (stdout, obuf, _IOFBF, sizeof (obuf));  /* nothing printed yet */
+    if (fmt == LIST_JSON)
+        printf ("[");
+    for (i = 0; i < l.n; i++)
+    {
+        centry *e = &l.e[i];
+
+        strftime (dtm, sizeof (dtm), fmt == LIST_TEXT ? "%Y-%m-%d %T"
+                  : "%Y-%m-%dT%T", localtime_r (&e->date, &tm));
+        snprintf (sz, sizeof (sz), e->size < 0 ? "-" : "%lld", e->size);
+
+        if (fmt == LIST_JSON)
+        {
+            printf ("%s\n{\"name\":", i ? "," : "");
+            t_json (stdout, e->name);
+            printf (",\"path\":");
+            t_json (stdout, e->path);
+            printf (",\"date\":\"%s\",\"size\":%s}", dtm,
+                    e->size < 0 ? "null" : sz);
+        }
+        else if (fmt == LIST_NUL)
+            printf ("%s%c%s%c%s%c%s%c", dtm, 0, sz, 0, e->name, 0, e->path, 0);
+        else
+            printf ("%s %12s  %s  %s\n", dtm, sz, e->name, e->path);
+
+        free ((char *) e->name);
+        free ((char *) e->path);
+    }
+    if (fmt == LIST_JSON)
+        printf ("%s]\n", l.n ? "\n" : "");
+    fflush (stdout);
+    free (l.e);
+
+    return l.n;
+}
+
+/* a file being counted by t_walk */
+typedef struct
+{
+    int res;
+    struct statx stx;
+    char name[NAME_MAX + 1];
+} tstat;
+
+/*
+ * t_walk: returns the disk usage of the file @name in directory @dfd, and
+ * all that is under it, or -1 on error. Entries of a directory are stat-ed
+ * in batches.
+ */
+static long long
+t_walk (int dfd, const char *name)
+{
+    int fd = -1, i = 0, n = 0;
+    dents *d = NULL;
+    tstat *ts = NULL;
+    long long sum = 0, sub = 0;
+    iobatch *b = iob_get ();
+    struct statx stx;
+    struct dirent64 *de = NULL;
+
+    if (statx (dfd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE|STATX_BLOCKS, &stx))
+        return -1;
+    sum = stx.stx_blocks * 512LL;
+    if (!S_ISDIR (stx.stx_mode))
+        return sum;
+
+    fd = openat (dfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd < 0 || (d = dents_open (fd, 64 * 1024)) == NULL
+        || (ts = malloc (IOB_DEPTH * sizeof (tstat))) == NULL)
+    {
+        sum = -1;
+        goto out;
+    }
+    do
+    {
+        for (n = 0; n < IOB_DEPTH && (de = dents_read (d)) != NULL; )
+        {
+            if (de->d_type == DT_DIR || de->d_type == DT_UNKNOWN)
+            {
+                if ((sub = t_walk (fd, de->d_name)) > 0)
+                    sum += sub;
+                continue;
+            }
+            strcpy (ts[n].name, de->d_name);
+            iob_statx (b, fd, ts[n].name, AT_SYMLINK_NOFOLLOW, STATX_BLOCKS,
+                       &ts[n].stx, &ts[n].res);
+            n++;
+        }
+        iob_submit (b);
+        for (i = 0; i < n; i++)
+            if (ts[i].res >= 0)
+                sum += ts[i].stx.stx_blocks * 512LL;
+    } while (n == IOB_DEPTH);
+
+out:
+    if (d != NULL)
+        dents_close (d);
+    if (fd >= 0)
+        close (fd);
+    free (ts);
+    return sum;
+}
+
+/*
+ * t_count: count the entries of unknown size, directories moved with a
+ * rename(2) or by other programs, once by walking them. Returns the disk
+ * usage of the trash, or -1 on error.
+ */
+long long
+t_count (void)
+{
+    tdir *td = NULL;
+    int ffd = -1;
+    size_t i = 0;
+    long unknown = 0;
+    long long total = 0, sz = 0;
+    tlist l = { NULL, 0, 0 };
+
+    td = t_cur ();
+    if (td->cat == NULL || (total = c_usage (td->cat, &unknown)) < 0)
+    {
+        warnx ("could not read trash catalog");
+        return -1;
+    }
+    if (!unknown)
+        return total;
+
+    if (c_foreach (td->cat, t_collect, &l) < 0)
+        return -1;
+    ffd = openat (td->fd, "../files", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    for (i = 0; i < l.n; i++)
+    {
+        centry *e = &l.e[i];
+
+        if (e->size < 0 && ffd >= 0 && (sz = t_walk (ffd, e->name)) >= 0
+            && !c_setsize (td->cat, e->name, sz) && e->dir)
+            td->dsdirty = 1;
+        free ((char *) e->name);
+        free ((char *) e->path);
+    }
+    if (ffd >= 0)
+        close (ffd);
+    free (l.e);
+
+    return c_usage (td->cat, &unknown);
+}
+
+static void
+t_pdu (const centry *e, void *arg)
+{
+    (void) arg;
+    printf ("%lld\t%s\n", e->size, e->name);
+}
+
+/*
+ * t_du: print the disk usage of the trashes in use, per entry too in verbose
+ * mode, and per trash when there are more than one. Usage comes from the
+ * catalogs, the trash is not walked but for entries of unknown size. Returns
+ * the total, or -1 on error.
+ */
+long long
+t_du (void)
+{
+    tdir *td = NULL;
+    long long total = 0, sz = 0;
+
+    for (td = tdirs; td != NULL; td = td->next)
+    {
+        tcur = td;
+        if ((sz = t_count ()) < 0)
+            return -1;
+        if ((mode & VERBOSE) && c_foreach (td->cat, t_pdu, NULL) < 0)
+            return -1;
+        if (tdirs->next != NULL)
+            printf ("%lld\t%s\n", sz, td->files);
+        total += sz;
+    }
+    printf ("%lld\ttotal\n", total);
+    t_dirsizes ();
+
+    return total;
+}
+
+/*
+ * t_evict: returns the trash name of the oldest entry when it is to go:
+ * it is older than @maxage seconds, or the trash uses more than @maxsize
+ * bytes. Entries of unknown size are counted first, see t_count. Entries
+ * deleted at @since or later are kept. Returns NULL when nothing is to go.
+ * Negative limits are not checked.
+ */
+char *
+t_evict (long long maxsize, long maxage, time_t since)
+{
+    tdir *td = NULL;
+    centry e;
+    long unknown = 0;
+    long long total = 0;
+
+    td = t_cur ();
+    if (td->cat == NULL || c_oldest (td->cat, &e) < 0)
+        return NULL;
+    if (e.date < since)
+    {
+        if (maxage >= 0 && e.date < time (NULL) - maxage)
+            return (char *) e.name;
+        if (maxsize >= 0 && (total = c_usage (td->cat, &unknown)) >= 0
+            && unknown)
+            total = t_count ();
+        if (maxsize >= 0 && total > maxsize)
+            return (char *) e.name;
+    }
+    free ((char *) e.name);
+
+    return NULL;
+}
+
+/*
+ * t_dirsizes: update the FreeDesktop Trash/directorysizes cache of each
+ * trash, when directories were added to or removed from it.
+ */
+void
+t_dirsizes (void)
+{
+    tdir *td = NULL;
+
+    for (td = tdirs; td != NULL; td = td->next)
+        if (td->dsdirty && td->cat != NULL)
+        {
+            c_dirsizes (td->cat);
+            td->dsdirty = 0;
+        }
+}
+
+/*
+ * t_sync: in --sync=batch mode, records are written without an fsync(2)
+ * each. Flush them, and the files they describe, with one syncfs(2) on each
+ * trash file system at the end of the run.
+ */
+void
+t_sync (void)
+{
+    tdir *td = NULL;
+
+    if (tsync != SYNC_BATCH)
+        return;
+
+    for (td = tdirs; td != NULL; td = td->next)
+    {
+        if (!td->dirty)
+            continue;
+#ifdef HAVE_SYNCFS
+        if (syncfs (td->fd) < 0)
+            warn ("could not flush trash info records");
+#else
+        sync ();
+#endif
+        td->dirty = 0;
+    }
+}
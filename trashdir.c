@@ -0,0 +1,356 @@
+/*
+ * trashdir.c -- move unwanted files to trash; This file is part of the
+ * program 'ptrash'.
+ * Copyright (C) 2026 Prasad J Pandit
+ *
+ * 'ptrash' is a free software; you can redistribute it and/or modify it under
+ * the terms of GNU General Public Licence as published by Free Software
+ * Foundation; either version 2 of the licence, or (at your option) any later
+ * version.
+ *
+ * 'ptrash' is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public Licence for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public Licence along
+ * with 'ptrash'; if not, write to Free Software Foundation, Inc., 51 Franklin
+ * St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Trash directories. Files are moved to the home trash when they live on
+ * its file system, and to the trash at the top of their own mount otherwise:
+ * $topdir/.Trash/$uid when the administrator has made $topdir/.Trash a
+ * sticky directory, or $topdir/.Trash-$uid. A move to trash then is a
+ * rename(2), and not a copy across file systems. The mount table is read
+ * once from /proc/self/mountinfo.
+ */
+
+#include <ptrash.h>
+#include <sys/sysmacros.h>     /* for makedev */
+
+#define MOUNTINFO       "/proc/self/mountinfo"
+
+/* a mounted file system */
+typedef struct
+{
+    dev_t dev;
+    char *dir;              /* mount point */
+    short skip;             /* autofs, reading it would mount it */
+} mnt;
+
+static mnt *mnts = NULL;
+static int nmnt = -1;
+
+static trash **trs = NULL;  /* known trashes, the home trash first */
+static int ntr = 0;
+static char **bad = NULL;   /* top directories without a usable trash */
+static int nbad = 0;
+
+
+/*
+ * m_unescape: undo the octal escapes of a field of the mount table, in
+ * place.
+ */
+static char *
+m_unescape (char *s)
+{
+    char *p = s, *q = s;
+
+    while (*p)
+    {
+        if (p[0] == '\\' && p[1] >= '0' && p[1] <= '3'
+            && p[2] >= '0' && p[2] <= '7' && p[3] >= '0' && p[3] <= '7')
+        {
+            *q++ = (p[1] - '0') << 6 | (p[2] - '0') << 3 | (p[3] - '0');
+            p += 4;
+        }
+        else
+            *q++ = *p++;
+    }
+    *q = '\0';
+
+    return s;
+}
+
+
+/*
+ * m_load: read the mount table once. Fields of a line are: mount id, parent
+ * id, major:minor, root, mount point, options, optional fields up to `-',
+ * file system type and source.
+ */
+static void
+m_load (void)
+{
+    FILE *fp = NULL;
+    char *ln = NULL, *f[5], *t = NULL;
+    size_t sz = 0;
+    unsigned mj = 0, mn = 0;
+    int i = 0, cap = 0;
+
+    if (nmnt >= 0)
+        return;
+    nmnt = 0;
+    if ((fp = fopen (MOUNTINFO, "re")) == NULL)
+        return;
+
+    while (getline (&ln, &sz, fp) > 0)
+    {
+        mnt *p = NULL;
+        char *sp = NULL;
+
+        for (i = 0, t = strtok_r (ln, " \n", &sp); i < 5 && t != NULL;
+             t = strtok_r (NULL, " \n", &sp))
+            f[i++] = t;
+        if (i < 5 || sscanf (f[2], "%u:%u", &mj, &mn) != 2)
+            continue;
+        while (t != NULL && strcmp (t, "-"))
+            t = strtok_r (NULL, " \n", &sp);
+        if (t != NULL)
+            t = strtok_r (NULL, " \n", &sp);
+
+        if (nmnt == cap)
+        {
+            if ((p = realloc (mnts, (cap = cap ? cap * 2 : 32)
+                                    * sizeof (mnt))) == NULL)
+                break;
+            mnts = p;
+        }
+        if ((mnts[nmnt].dir = strdup (m_unescape (f[4]))) == NULL)
+            break;
+        mnts[nmnt].dev = makedev (mj, mn);
+        mnts[nmnt].skip = t != NULL && !strcmp (t, "autofs");
+        nmnt++;
+    }
+    free (ln);
+    fclose (fp);
+}
+
+
+/*
+ * m_top: returns the top directory of the mount holding @path, on the
+ * device @dev, or NULL if it is not found. Of the mounts of @dev, the one
+ * with the longest mount point leading @path is taken. File systems such as
+ * btrfs report a device of their own for each sub-volume; for those the
+ * top is found by walking up @path until the device changes.
+ */
+static char *
+m_top (const char *path, dev_t dev)
+{
+    int i = 0;
+    size_t l = 0, best = 0;
+    char *top = NULL, *p = NULL;
+    struct stat sb;
+
+    m_load ();
+    for (i = 0; i < nmnt; i++)
+    {
+        l = strlen (mnts[i].dir);
+        if (mnts[i].dev == dev && (l == 1 || (!strncmp (path, mnts[i].dir, l)
+            && (path[l] == '/' || !path[l]))) && (top == NULL || l > best))
+        {
+            top = mnts[i].dir;
+            best = l;
+        }
+    }
+    if (top != NULL)
+        return strdup (top);
+
+    if ((top = strdup (path)) == NULL)
+        return NULL;
+    while ((p = strrchr (top, '/')) != NULL && top[1])
+    {
+        char c = p[p == top];
+
+        p[p == top] = '\0';    /* parent directory, the root keeps its `/' */
+        if (lstat (top, &sb) < 0 || sb.st_dev != dev)
+        {
+            p[p == top] = c;
+            break;
+        }
+    }
+
+    return top;
+}
+
+
+/*
+ * m_root: returns 1 if @root is a directory of the user on device @dev,
+ * creating it first when @create is set, or 0 otherwise.
+ */
+static int
+m_root (const char *root, dev_t dev, short create)
+{
+    struct stat sb;
+
+    if (create && mkdir (root, S_IRWXU) < 0 && errno != EEXIST)
+        return 0;
+    if (lstat (root, &sb) < 0 || !S_ISDIR (sb.st_mode)
+        || sb.st_uid != getuid () || sb.st_dev != dev)
+        return 0;
+
+    return 1;
+}
+
+
+/*
+ * m_trash: returns the trash of the mount at @top on device @dev, or NULL if
+ * it has none. With @create set the trash is created when it is missing.
+ */
+static trash *
+m_trash (const char *top, dev_t dev, short create)
+{
+    char uid[24], *dir = NULL, *root = NULL, *files = NULL, *info = NULL;
+    struct stat sb;
+
+    snprintf (uid, sizeof (uid), "%u", (unsigned) getuid ());
+    dir = build_path (top, ".Trash");
+
+    /* $topdir/.Trash is used only if it is a sticky directory, not a link */
+    if (dir != NULL && !lstat (dir, &sb) && S_ISDIR (sb.st_mode)
+        && (sb.st_mode & S_ISVTX))
+    {
+        root = build_path (dir, uid);
+        if (root != NULL && !m_root (root, dev, create))
+        {
+            free (root);
+            root = NULL;
+        }
+    }
+    free (dir);
+    if (root == NULL)
+    {
+        snprintf (uid, sizeof (uid), ".Trash-%u", (unsigned) getuid ());
+        root = build_path (top, uid);
+        if (root != NULL && !m_root (root, dev, create))
+        {
+            free (root);
+            return NULL;
+        }
+    }
+    if (root == NULL)
+        return NULL;
+
+    files = build_path (root, "files");
+    info = build_path (root, "info/");
+    free (root);
+    if (files == NULL || info == NULL || !m_root (files, dev, create)
+        || !m_root (info, dev, create))
+    {
+        free (files);
+        free (info);
+        return NULL;
+    }
+
+    return trash_add (files, info, strdup (top), dev);
+}
+
+
+/*
+ * trash_add: add a trash to the list of known ones; it takes over the
+ * strings @files, @info and @top. Returns the trash, or NULL on error.
+ */
+trash *
+trash_add (char *files, char *info, char *top, dev_t dev)
+{
+    trash *t = NULL, **p = NULL;
+
+    assert (files != NULL && info != NULL);
+
+    if ((t = malloc (sizeof (trash))) == NULL
+        || (p = realloc (trs, (ntr + 1) * sizeof (trash *))) == NULL)
+    {
+        free (t);
+        return NULL;
+    }
+    t->files = files;
+    t->info = info;
+    t->top = top;
+    t->fd = -1;
+    t->dev = dev;
+    trs = p;
+    trs[ntr++] = t;
+
+    return t;
+}
+
+
+/*
+ * trash_of: returns the trash for the file at @path, on device @dev. That is
+ * the home trash for files on its device, and the trash at the top of the
+ * file's mount otherwise. When that trash can not be used the home trash is
+ * returned; the file is copied to it.
+ */
+trash *
+trash_of (const char *path, dev_t dev)
+{
+    int i = 0;
+    char *top = NULL, **p = NULL;
+    trash *t = NULL;
+
+    assert (path != NULL && ntr > 0);
+
+    if (dev == trs[0]->dev || (top = m_top (path, dev)) == NULL)
+        return trs[0];
+    for (i = 1; i < ntr; i++)
+        if (trs[i]->dev == dev && !strcmp (trs[i]->top, top))
+            break;
+    if (i < ntr)
+        t = trs[i];
+    for (i = 0; t == NULL && i < nbad; i++)
+        if (!strcmp (bad[i], top))
+            t = trs[0];
+    if (t == NULL && (t = m_trash (top, dev, 1)) == NULL)
+    {
+        t = trs[0];
+        if ((p = realloc (bad, (nbad + 1) * sizeof (char *))) != NULL)
+        {
+            bad = p;
+            bad[nbad++] = top;
+            top = NULL;
+        }
+    }
+    free (top);
+
+    return t;
+}
+
+
+/*
+ * trash_scan: add the trashes present at the top of the mounted file
+ * systems to the known ones. Mounts with a known trash are skipped, so that
+ * ptrashd may scan again for trashes made since. Returns the number of
+ * known trashes.
+ */
+int
+trash_scan (void)
+{
+    int i = 0, j = 0;
+
+    m_load ();
+    for (i = 0; i < nmnt; i++)
+    {
+        if (mnts[i].skip || (ntr > 0 && mnts[i].dev == trs[0]->dev))
+            continue;
+        for (j = 1; j < ntr; j++)
+            if (!strcmp (trs[j]->top, mnts[i].dir))
+                break;
+        if (j < ntr)
+            continue;
+        m_trash (mnts[i].dir, mnts[i].dev, 0);
+    }
+
+    return ntr;
+}
+
+
+/*
+ * trash_get: returns the known trash @n, the home trash being 0, or NULL
+ * past the last one.
+ */
+trash *
+trash_get (int n)
+{
+    return n >= 0 && n < ntr ? trs[n] : NULL;
+}